@@ -0,0 +1,194 @@
+// Address space identifiers.
+//
+// Each process runs with an ASID in satp, both in user space and
+// on its kernel page table, which maps its user memory the same
+// way and kernel memory that the user page table doesn't map.
+// Its TLB entries are tagged with the ASID and survive switches
+// to the scheduler's page table (ASID 0) and to other processes:
+// trampoline.S and kvmswitch() only flush the TLB when the hart
+// has no ASIDs.
+//
+// ASIDs are handed out in generations. A process keeps its ASID
+// for as long as the generation it got it in lasts. When they run
+// out, a new generation starts, and each hart flushes its whole
+// TLB before it next returns to user space, after which every
+// process gets a new ASID when it next runs.
+//
+// A process's TLB entries may be cached on every hart it has
+// run on. tlb_flush() and tlb_flushall() are called after its
+// valid PTEs change; they flush this hart at once and leave the
+// other harts to flush the process's ASID in asid_switch(),
+// before they run it again.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "kstats.h"
+
+#define ALLCPUS ((1U << NCPU) - 1)
+
+extern pagetable_t kernel_pagetable;
+
+struct {
+  struct spinlock lock;
+  uint64 gen;   // current generation, from 1
+  int next;     // next ASID to hand out in it
+  int max;      // largest ASID the harts have, 0 if none
+} asid;
+
+// How many ASID bits does this hart implement? Write all ones
+// to the field, and see which stick.
+static int
+asidprobe(void)
+{
+  uint64 satp = r_satp();
+  int max;
+
+  w_satp(satp | SATP_ASIDMASK);
+  max = (r_satp() & SATP_ASIDMASK) >> SATP_ASIDSHIFT;
+  w_satp(satp);
+  sfence_vma();
+  return max;
+}
+
+// Called on hart 0, with paging on.
+void
+asidinit(void)
+{
+  initlock(&asid.lock, "asid");
+  asid.gen = 1;
+  asid.next = 1;
+  asid.max = asidprobe();
+  mycpu()->asidgen = asid.gen;
+  // with none, the TLB is flushed on every return to user.
+  kstats.asids = asid.max;
+}
+
+// Called on the other harts, with paging on.
+void
+asidinithart(void)
+{
+  if(asidprobe() < asid.max)
+    panic("asidinithart: fewer ASIDs than hart 0");
+  mycpu()->asidgen = *(volatile uint64*)&asid.gen;
+}
+
+// Make sure p has an ASID of the current generation, flush
+// whatever this hart has cached that p mustn't see, and return
+// p's ASID, in place for satp. Interrupts must be off.
+static uint64
+asid_switch(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint me = 1U << cpuid();
+
+  if(asid.max == 0)
+    return 0;
+
+  if(p->asidgen != *(volatile uint64*)&asid.gen){
+    acquire(&asid.lock);
+    if(asid.next > asid.max){
+      asid.gen++;
+      asid.next = 1;
+      __sync_fetch_and_add(&kstats.asidrollovers, 1);
+    }
+    p->asid = asid.next++;
+    p->asidgen = asid.gen;
+    release(&asid.lock);
+    // no hart has entries for it in this generation, once
+    // each has flushed the last one's.
+    __atomic_store_n(&p->tlbstale, 0, __ATOMIC_SEQ_CST);
+    // order the stores that built p's page table before
+    // the hart's walks of it.
+    sfence_vma_asid(p->asid);
+  }
+
+  if(c->asidgen != p->asidgen){
+    sfence_vma();
+    c->asidgen = p->asidgen;
+    __sync_fetch_and_and(&p->tlbstale, ~me);
+    __sync_fetch_and_add(&kstats.tlbflushes, 1);
+  } else if(__atomic_load_n(&p->tlbstale, __ATOMIC_SEQ_CST) & me){
+    __sync_fetch_and_and(&p->tlbstale, ~me);
+    sfence_vma_asid(p->asid);
+    __sync_fetch_and_add(&kstats.asidflushes, 1);
+  }
+
+  return (uint64)p->asid << SATP_ASIDSHIFT;
+}
+
+// Switch this hart to p's kernel page table, with p's ASID,
+// or to the kernel's own if p is 0. Called by the scheduler
+// around running p, and when p's page table or ASID changes.
+void
+kvmswitch(struct proc *p)
+{
+  uint64 satp;
+
+  push_off();
+  if(p == 0){
+    // it has no user memory, so nothing can be stale.
+    w_satp(MAKE_SATP(kernel_pagetable));
+  } else {
+    satp = MAKE_SATP(p->kpagetable) | asid_switch(p);
+    if(r_satp() != satp){
+      w_satp(satp);
+      if(asid.max == 0){
+        // the last process's user memory may be cached.
+        sfence_vma();
+        __sync_fetch_and_add(&kstats.tlbflushes, 1);
+      }
+    }
+  }
+  pop_off();
+}
+
+// A valid PTE for va in the page table of p, the current
+// process, has changed. The kernel may have it cached too,
+// since p's kernel page table maps p's user memory.
+void
+tlb_flush(struct proc *p, uint64 va)
+{
+  uint me;
+
+  if(asid.max == 0){
+    // everything runs as ASID 0, and other harts flush
+    // everything before they next run p.
+    sfence_vma_page(va, 0);
+    return;
+  }
+  push_off();
+  me = 1U << cpuid();
+  if(p->asidgen == mycpu()->asidgen)
+    sfence_vma_page(va, p->asid);
+  __sync_fetch_and_or(&p->tlbstale, ALLCPUS & ~me);
+  pop_off();
+}
+
+// Many of the PTEs in p's page table have changed, or
+// page-table pages were freed. p need not be running.
+void
+tlb_flushall(struct proc *p)
+{
+  struct proc *me = myproc();
+
+  if(asid.max == 0){
+    if(p == me)
+      sfence_vma();
+    return;
+  }
+  __sync_fetch_and_or(&p->tlbstale, ALLCPUS);
+  // this hart may go on using p's kernel page table
+  // before it next returns to user space.
+  if(p == me){
+    push_off();
+    __sync_fetch_and_and(&p->tlbstale, ~(1U << cpuid()));
+    if(p->asidgen == mycpu()->asidgen)
+      sfence_vma_asid(p->asid);
+    pop_off();
+  }
+}
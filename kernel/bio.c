@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,7 +12,27 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
-
+//
+// Each buffer is on the list of the bucket its (dev, blockno)
+// hashes to, and each bucket has its own lock, so looking up and
+// releasing blocks on different harts rarely contend. Unused
+// buffers are also on an LRU list, with a lock of its own, in
+// the order they were released, and a miss recycles the one at
+// its head, whatever the size of the cache. bcache.lock lets
+// only one miss at a time do that, so that two can't both add
+// the same block.
+//
+// The buffers live in pages from kalloc(), BPERPAGE to a page.
+// The cache starts with NBUF buffers and, while memory isn't low,
+// a miss adds a page of buffers rather than recycle one, up to
+// BCACHEPCT percent of memory. When memory is low, swapensure()
+// calls bshrink() to give back pages whose buffers are unused.
+//
+// Lock order: bcache.lock, then bucket locks, then
+// bcache.lrulock, then kalloc()'s. Only the holder of
+// bcache.lock holds two bucket locks at once. A buffer is on
+// the LRU list just when its refcnt is 0; both change together
+// under its bucket's lock.
 
 #include "types.h"
 #include "param.h"
@@ -22,70 +42,310 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstats.h"
 
-struct {
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;     // list of the bucket's buffers, through prev/next
+};
+
+#define BPERPAGE ((PGSIZE - sizeof(void*)) / sizeof(struct buf))
+
+struct bpage {
+  struct bpage *next;   // bcache.pages list
+  struct buf buf[BPERPAGE];
+};
+
+struct {
+  struct spinlock lock; // held while adding, recycling or freeing buffers
+  struct bucket bucket[NBUCKET];
+  struct bpage *pages;  // the pages the buffers are in
+  int npages;
+  int maxpages;         // most pages the cache may grow to
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  struct spinlock lrulock;
+  struct buf *lruhead;  // unused buffers, released longest ago
+  struct buf *lrutail;  // first, through lruprev/lrunext
+  int nlru;             // buffers on the LRU list
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+static void
+blink(struct bucket *bk, struct buf *b)
+{
+  b->prev = 0;
+  b->next = bk->head;
+  if(b->next)
+    b->next->prev = b;
+  bk->head = b;
+}
+
+static void
+bunlink(struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    b->bucket->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+}
+
+// Add b, unused, to the LRU list: at the tail, or at the head
+// if it holds no block. Caller holds b's bucket lock.
+static void
+lrulink(struct buf *b, int head)
+{
+  acquire(&bcache.lrulock);
+  if(head){
+    b->lruprev = 0;
+    b->lrunext = bcache.lruhead;
+  } else {
+    b->lruprev = bcache.lrutail;
+    b->lrunext = 0;
+  }
+  if(b->lruprev)
+    b->lruprev->lrunext = b;
+  else
+    bcache.lruhead = b;
+  if(b->lrunext)
+    b->lrunext->lruprev = b;
+  else
+    bcache.lrutail = b;
+  if(bcache.nlru++ == 0)
+    wakeup(&bcache.lruhead);  // a miss may be waiting in bref()
+  release(&bcache.lrulock);
+}
+
+// Take b off the LRU list. Caller holds b's bucket lock.
+static void
+lruunlink(struct buf *b)
+{
+  acquire(&bcache.lrulock);
+  if(b->lruprev)
+    b->lruprev->lrunext = b->lrunext;
+  else
+    bcache.lruhead = b->lrunext;
+  if(b->lrunext)
+    b->lrunext->lruprev = b->lruprev;
+  else
+    bcache.lrutail = b->lruprev;
+  bcache.nlru--;
+  release(&bcache.lrulock);
+}
+
+// Take a reference to b. Caller holds b's bucket lock.
+static void
+bhold(struct buf *b)
+{
+  if(b->refcnt++ == 0)
+    lruunlink(b);
+}
+
+// Drop a reference to b, stamping it with the time and
+// putting it on the LRU list if it was the last. Caller
+// holds b's bucket lock.
+static void
+bdrop(struct buf *b)
+{
+  if(--b->refcnt == 0){
+    b->lastuse = ticks;
+    lrulink(b, 0);
+  }
+}
+
+// Add a page of buffers, holding no block, to bucket 0.
+// Caller holds bcache.lock. Returns 0 if out of memory.
+static int
+bgrow(void)
+{
+  struct bucket *bk = &bcache.bucket[0];
+  struct bpage *pg;
+  struct buf *b;
+
+  if((pg = (struct bpage*)kalloc()) == 0)
+    return 0;
+  memset(pg, 0, sizeof(*pg));
+  acquire(&bk->lock);
+  for(b = pg->buf; b < &pg->buf[BPERPAGE]; b++){
+    initsleeplock(&b->lock, "buffer");
+    b->bucket = bk;
+    blink(bk, b);
+    lrulink(b, 1);
+  }
+  release(&bk->lock);
+  pg->next = bcache.pages;
+  bcache.pages = pg;
+  bcache.npages++;
+  return 1;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
-
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  initlock(&bcache.lrulock, "bcache.lru");
+  for(bk = bcache.bucket; bk < &bcache.bucket[NBUCKET]; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head = 0;
   }
+  bcache.maxpages = kfreepages() / 100 * BCACHEPCT;
+  acquire(&bcache.lock);
+  while(bcache.npages * BPERPAGE < NBUF)
+    if(!bgrow())
+      panic("binit");
+  release(&bcache.lock);
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Look for block blockno on device dev in bk. If it is there,
+// take a reference to it. Caller holds bk->lock.
 static struct buf*
-bget(uint dev, uint blockno)
+bfind(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head; b; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+      bhold(b);
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+// Take the unused buffer released longest ago off the LRU
+// list, and return it with its bucket's lock held, or 0 if
+// every buffer is in use. Caller holds bcache.lock, so buffers
+// can't change buckets.
+static struct buf*
+bvictim(void)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  for(;;){
+    acquire(&bcache.lrulock);
+    if((b = bcache.lruhead) == 0){
+      release(&bcache.lrulock);
+      return 0;
+    }
+    bk = b->bucket;
+    release(&bcache.lrulock);
+    acquire(&bk->lock);
+    // still unused, unless someone took it meanwhile.
+    if(b->refcnt == 0){
+      lruunlink(b);
+      return b;
+    }
+    release(&bk->lock);
+  }
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer. In either case, return
+// the buffer, with a reference but not locked, and say in
+// *hit whether the block was cached. If every buffer is in
+// use, wait for one if wait is set, or else return 0.
+static struct buf*
+bref(uint dev, uint blockno, int *hit, int wait)
+{
+  struct bucket *bk = bhash(dev, blockno);
+  struct buf *b;
+
+  // Is the block already cached?
+  *hit = 1;
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b)
+    return b;
+
+  // Not cached. Look again once no other miss can be adding
+  // it, then grow the cache if there is memory to spare, and
+  // recycle the least recently used buffer, a new one if so.
+  for(;;){
+    acquire(&bcache.lock);
+    acquire(&bk->lock);
+    b = bfind(bk, dev, blockno);
+    release(&bk->lock);
+    if(b){
       release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
+    if(bcache.npages < bcache.maxpages && kfreepages() >= 2*SWAPLOW)
+      bgrow();
+    if((b = bvictim()) != 0)
+      break;
+    // with the log's writes in flight at once, every buffer may
+    // be in use even when the cache is as big as it may grow:
+    // grow past that if memory allows, or else make some free
+    // and wait for a buffer to be released.
+    if(kfreepages() >= 2*SWAPLOW && bgrow() && (b = bvictim()) != 0)
+      break;
+    if(!wait){
+      release(&bcache.lock);
+      return 0;
+    }
+    acquire(&bcache.lrulock);
+    release(&bcache.lock);
+    if(bcache.lruhead == 0 && kfreepages() < 2*SWAPLOW){
+      release(&bcache.lrulock);
+      swapensure();
+      acquire(&bcache.lrulock);
+      if(bcache.lruhead == 0 && kfreepages() < 2*SWAPLOW)
+        sleep(&bcache.lruhead, &bcache.lrulock);
+    }
+    release(&bcache.lrulock);
   }
-  panic("bget: no buffers");
+  if(b->valid)
+    __sync_fetch_and_add(&kstats.bcacheevicts, 1);
+  bunlink(b);
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->ahead = 0;
+  b->refcnt = 1;
+  release(&b->bucket->lock);
+  b->bucket = bk;
+  acquire(&bk->lock);
+  blink(bk, b);
+  release(&bk->lock);
+  release(&bcache.lock);
+  *hit = 0;
+  return b;
+}
+
+// Drop a reference to b, putting it on the LRU list, for
+// bvictim(), if it was the last.
+static void
+bput(struct buf *b)
+{
+  acquire(&b->bucket->lock);
+  bdrop(b);
+  release(&b->bucket->lock);
+}
+
+// Return a locked buffer for the block, cached or not.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+  int hit;
+
+  b = bref(dev, blockno, &hit, 1);
+  if(hit)
+    __sync_fetch_and_add(&kstats.bcachehits, 1);
+  else
+    __sync_fetch_and_add(&kstats.bcachemisses, 1);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -96,23 +356,85 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    blk_rw(b, 0);
     b->valid = 1;
   }
+  if(b->ahead){
+    b->ahead = 0;
+    __sync_fetch_and_add(&kstats.rahits, 1);
+  }
   return b;
 }
 
+// Start reading the indicated block into the cache, unless it
+// is there already, and return without waiting for the disk.
+// The buffer stays locked until the read is done, so bread()
+// waits for it. Returns -1, having done nothing, if every
+// buffer is in use, since readahead isn't worth waiting for.
+int
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+  int hit;
+
+  if((b = bref(dev, blockno, &hit, 0)) == 0)
+    return -1;
+  if(hit){
+    bput(b);
+    return 0;
+  }
+  // nobody else has this new buffer locked, unless they
+  // found it in the moment since, and have read it.
+  acquiresleep(&b->lock);
+  if(b->valid){
+    brelse(b);
+    return 0;
+  }
+  b->ahead = 1;
+  blk_start(b, 0, bdone);
+  __sync_fetch_and_add(&kstats.readaheads, 1);
+  return 0;
+}
+
+// virtio_disk_intr() has read b for breadahead().
+// Called in interrupt context.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  __sync_synchronize();
+  releasesleep(&b->lock);
+  bput(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  blk_rw(b, 1);
+}
+
+// Start writing b's contents to disk, and return without
+// waiting; bwait() waits. Must be locked, until bwait().
+void
+bwritestart(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwritestart");
+  blk_start(b, 1, 0);
+}
+
+// Wait for the write bwritestart() started.
+void
+bwait(struct buf *b)
+{
+  blk_wait(b);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// If unused, it goes on the LRU list, for bvictim().
 void
 brelse(struct buf *b)
 {
@@ -120,34 +442,121 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt++;
-  release(&bcache.lock);
+  acquire(&b->bucket->lock);
+  bhold(b);
+  release(&b->bucket->lock);
 }
 
 void
 bunpin(struct buf *b) {
+  acquire(&b->bucket->lock);
+  bdrop(b);
+  release(&b->bucket->lock);
+}
+
+// Are all of pg's buffers unused? The stamp of the one
+// released last is in *stamp. Racy unless the caller holds
+// the buffers' bucket locks.
+static int
+bpageidle(struct bpage *pg, uint *stamp)
+{
+  struct buf *b;
+
+  *stamp = 0;
+  for(b = pg->buf; b < &pg->buf[BPERPAGE]; b++){
+    if(b->refcnt)
+      return 0;
+    if(b->lastuse > *stamp)
+      *stamp = b->lastuse;
+  }
+  return 1;
+}
+
+// Give back to kalloc() up to n pages whose buffers are all
+// unused, those released longest ago first, keeping at least
+// NBUF buffers. Returns how many pages it freed.
+int
+bshrink(int n)
+{
+  struct bpage *pg, **pp, **victim;
+  struct bucket *held[BPERPAGE];
+  uint stamp, best;
+  int freed, nheld, i, j, idle;
+
   acquire(&bcache.lock);
-  b->refcnt--;
+  for(freed = 0; freed < n && (bcache.npages - 1) * BPERPAGE >= NBUF; freed++){
+    victim = 0;
+    best = 0;
+    for(pp = &bcache.pages; (pg = *pp) != 0; pp = &pg->next){
+      if(bpageidle(pg, &stamp) && (victim == 0 || stamp < best)){
+        victim = pp;
+        best = stamp;
+      }
+    }
+    if(victim == 0)
+      break;
+
+    // look again with the buffers' buckets locked. Their
+    // buckets can't change, since we hold bcache.lock.
+    pg = *victim;
+    nheld = 0;
+    for(i = 0; i < BPERPAGE; i++){
+      for(j = 0; j < nheld && held[j] != pg->buf[i].bucket; j++)
+        ;
+      if(j == nheld)
+        acquire(&(held[nheld++] = pg->buf[i].bucket)->lock);
+    }
+    if((idle = bpageidle(pg, &stamp)) != 0){
+      for(i = 0; i < BPERPAGE; i++){
+        bunlink(&pg->buf[i]);
+        lruunlink(&pg->buf[i]);
+      }
+    }
+    for(j = 0; j < nheld; j++)
+      release(&held[j]->lock);
+    if(!idle)
+      break;
+
+    *victim = pg->next;
+    bcache.npages--;
+    kfree((void*)pg);
+    __sync_fetch_and_add(&kstats.bcacheshrinks, 1);
+  }
   release(&bcache.lock);
+  return freed;
 }
 
+// The pages the buffer cache holds.
+int
+bpages(void)
+{
+  return *(volatile int*)&bcache.npages;
+}
+
+// How many buffers a miss could have now without waiting: the
+// unused ones, and those the cache may still grow by.
+int
+bspare(void)
+{
+  int n = *(volatile int*)&bcache.nlru;
+
+  if(kfreepages() >= 2*SWAPLOW)
+    n += (bcache.maxpages - *(volatile int*)&bcache.npages) * BPERPAGE;
+  return n;
+}
+
+// How many times the buffer cache's locks were found held.
+uint64
+bspins(void)
+{
+  uint64 n = bcache.lock.nspin + bcache.lrulock.nspin;
 
+  for(int i = 0; i < NBUCKET; i++)
+    n += bcache.bucket[i].lock.nspin;
+  return n;
+}
@@ -0,0 +1,126 @@
+// Block I/O scheduler, between the buffer cache and the disk.
+//
+// blk_start() doesn't give a buf to the disk driver at once but
+// queues it, in block order. When the queue is handed to the
+// driver, each run of bufs for consecutive blocks, read or
+// written alike, becomes one multi-segment virtio request of up
+// to MAXSEG blocks, rather than one request per block; since the
+// queue is sorted, the requests go out in one sweep up the disk,
+// as an elevator would send them.
+//
+// A process that is about to start several requests plugs the
+// queue with blk_plug(), and blk_unplug() hands over everything
+// queued in the meantime, so that log commits and readahead can
+// be merged. Otherwise the queue is handed over as soon as
+// anything is queued, and whenever someone waits for a request
+// still in it, so a plugged process can still bread() a block.
+//
+// The queue is shared: whoever hands it over takes everything in
+// it, including other processes' requests.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "buf.h"
+#include "kstats.h"
+#include "proc.h"
+#include "defs.h"
+
+struct {
+  struct spinlock lock;
+  struct buf *queue;   // linked through qnext, in block order
+} blkq;
+
+void
+blkinit(void)
+{
+  initlock(&blkq.lock, "blkq");
+}
+
+// Give everything queued to the disk, a run of consecutive
+// blocks at a time.
+static void
+blk_dispatch(void)
+{
+  struct buf *b, *first, *last;
+  int n;
+
+  acquire(&blkq.lock);
+  b = blkq.queue;
+  blkq.queue = 0;
+  release(&blkq.lock);
+
+  while(b){
+    first = last = b;
+    for(n = 1, b = b->qnext; b && n < MAXSEG; n++, b = b->qnext){
+      if(b->dev != last->dev || b->blockno != last->blockno + 1 ||
+         b->write != first->write)
+        break;
+      last = b;
+    }
+    last->qnext = 0;
+    __sync_fetch_and_add(&kstats.diskmerges, n - 1);
+    virtio_disk_start(first, first->write);
+  }
+}
+
+// Queue a read, or a write, of b, which the caller has locked,
+// and return without waiting. When the disk is done, done(b) is
+// called, in interrupt context, or, if done is 0, blk_wait(b)
+// returns.
+void
+blk_start(struct buf *b, int write, void (*done)(struct buf *))
+{
+  struct buf **pp;
+
+  b->write = write;
+  b->done = done;
+  b->disk = 1;
+  acquire(&blkq.lock);
+  for(pp = &blkq.queue; *pp; pp = &(*pp)->qnext)
+    if((*pp)->dev > b->dev || ((*pp)->dev == b->dev && (*pp)->blockno > b->blockno))
+      break;
+  b->qnext = *pp;
+  *pp = b;
+  release(&blkq.lock);
+
+  if(myproc()->blkplug == 0)
+    blk_dispatch();
+}
+
+// Wait for the transfer blk_start(b, write, 0) started.
+void
+blk_wait(struct buf *b)
+{
+  blk_dispatch();
+  virtio_disk_wait(b);
+}
+
+void
+blk_rw(struct buf *b, int write)
+{
+  blk_start(b, write, 0);
+  blk_wait(b);
+}
+
+// Hold back the requests this process queues, to be merged,
+// until blk_unplug(). Plugs nest.
+void
+blk_plug(void)
+{
+  myproc()->blkplug++;
+}
+
+void
+blk_unplug(void)
+{
+  struct proc *p = myproc();
+
+  if(p->blkplug <= 0)
+    panic("blk_unplug");
+  if(--p->blkplug == 0)
+    blk_dispatch();
+}
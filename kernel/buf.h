@@ -1,12 +1,20 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int ahead;   // read ahead, and not yet asked for
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint lastuse;     // ticks when last released
+  struct bucket *bucket; // hash bucket the buf is on
+  struct buf *prev; // bucket list
   struct buf *next;
+  struct buf *lruprev; // LRU list of unused buffers, while refcnt is 0
+  struct buf *lrunext;
+  int write;        // queued to be written, not read; see blk.c
+  void (*done)(struct buf *); // called when the disk is done, or 0
+  struct buf *qnext; // blk.c queue, then the rest of a disk request
   uchar data[BSIZE];
 };
 
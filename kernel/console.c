@@ -80,48 +80,53 @@ int
 consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
-  int c;
-  char cbuf;
+  int c, m, done = 0;
+  char cbuf[INPUT_BUF_SIZE];
 
   target = n;
-  acquire(&cons.lock);
-  while(n > 0){
-    // wait until interrupt handler has put some
-    // input into cons.buffer.
-    while(cons.r == cons.w){
-      if(killed(myproc())){
-        release(&cons.lock);
-        return -1;
+  while(n > 0 && !done){
+    // take input into cbuf under cons.lock, and only then copy
+    // it to dst, which may fault, and page in, and sleep.
+    acquire(&cons.lock);
+    for(m = 0; m < n && m < sizeof(cbuf) && !done; ){
+      // wait until interrupt handler has put some
+      // input into cons.buffer.
+      while(cons.r == cons.w){
+        if(killed(myproc())){
+          release(&cons.lock);
+          return -1;
+        }
+        sleep(&cons.r, &cons.lock);
       }
-      sleep(&cons.r, &cons.lock);
-    }
 
-    c = cons.buf[cons.r++ % INPUT_BUF_SIZE];
+      c = cons.buf[cons.r++ % INPUT_BUF_SIZE];
 
-    if(c == C('D')){  // end-of-file
-      if(n < target){
-        // Save ^D for next time, to make sure
-        // caller gets a 0-byte result.
-        cons.r--;
+      if(c == C('D')){  // end-of-file
+        if(m > 0 || n < target){
+          // Save ^D for next time, to make sure
+          // caller gets a 0-byte result.
+          cons.r--;
+        }
+        done = 1;
+        break;
       }
-      break;
-    }
 
-    // copy the input byte to the user-space buffer.
-    cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
-      break;
+      cbuf[m++] = c;
 
-    dst++;
-    --n;
+      if(c == '\n'){
+        // a whole line has arrived, return to
+        // the user-level read().
+        done = 1;
+      }
+    }
+    release(&cons.lock);
 
-    if(c == '\n'){
-      // a whole line has arrived, return to
-      // the user-level read().
+    // copy the input to the user-space buffer.
+    if(either_copyout(user_dst, dst, cbuf, m) == -1)
       break;
-    }
+    dst += m;
+    n -= m;
   }
-  release(&cons.lock);
 
   return target - n;
 }
@@ -8,6 +8,10 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct kstats;
+struct slabcache;
+struct slabinfo;
+struct timer;
 
 
 
@@ -16,8 +20,24 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritestart(struct buf*);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             breadahead(uint, uint);
+void            bdone(struct buf*);
+uint64          bspins(void);
+int             bshrink(int);
+int             bpages(void);
+int             bspare(void);
+
+// blk.c
+void            blkinit(void);
+void            blk_start(struct buf*, int, void (*)(struct buf*));
+void            blk_wait(struct buf*);
+void            blk_rw(struct buf*, int);
+void            blk_plug(void);
+void            blk_unplug(void);
 
 // console.c
 void            consoleinit(void);
@@ -26,6 +46,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execfault(pagetable_t, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -36,12 +57,37 @@ int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
 
+// mmap.c
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+struct vma*     mmapfind(struct proc*, uint64);
+uint64          mmapbase(struct proc*);
+int             mmapfault(struct proc*, uint64);
+void            mmapclear(struct proc*);
+int             mmapprefault(struct proc*);
+int             mmapfork(struct proc*, struct proc*);
+
+// swap.c
+void            swapinit(void);
+int             swapfreepages(void);
+void            swapdup(uint);
+void            swapfree(uint);
+void            swapensure(void);
+int             swapin(pte_t*);
+
+// pcache.c
+void            pcacheinit(void);
+char*           pcache_get(struct inode*, uint);
+void            pcache_inval(struct inode*);
+
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            iexec(struct inode*);
+void            iexecput(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -62,14 +108,31 @@ void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
 // kalloc.c
+extern struct kstats kstats;
+extern void*    zeropage;
 void*           kalloc(void);
 void            kfree(void *);
+void*           kzalloc(void);
+int             kzero_fill(void);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+void*           kalloc_mega(void);
+void            kfree_mega(void *);
+void            kmemdump(void);
+int             kfreepages(void);
 void            kinit(void);
 void            init_pagereference(void);
 void            pagereference_decrease(void*pa);
 void            pagereference_increase(void*pa);
 int             get_pagereference(void*pa);
 int             page_fault_handler(void*va,pagetable_t pagetable);
+
+// slab.c
+void            slabinit(void);
+struct slabcache* slab_create(char*, uint);
+void*           slab_alloc(struct slabcache*);
+void            slab_free(struct slabcache*, void*);
+int             slabstats(struct slabinfo*, int);
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
@@ -81,6 +144,7 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+void            pipeinit(void);
 
 // printf.c
 void            printf(char*, ...);
@@ -91,6 +155,8 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             vfork(void);
+void            vforkdone(struct proc*);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -119,7 +185,15 @@ int             settickets(int numbertickets);
 int             do_rand(unsigned long *ctx);
 //new
 int             waitx(uint64, uint*, uint*);
-void            preemptandaging(void);
+
+// runq.c
+void            runqinit(void);
+void            runq_push(struct proc*);
+struct proc*    runq_pop(void);
+void            runq_idle(void);
+void            runq_requeue(struct proc*);
+void            runq_age(void);
+int             runq_waiting(int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -155,12 +229,28 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// asid.c
+void            asidinit(void);
+void            asidinithart(void);
+void            kvmswitch(struct proc*);
+void            tlb_flush(struct proc*, uint64);
+void            tlb_flushall(struct proc*);
+
+// timer.c
+void            timer_add(struct timer*, uint, void (*)(void*), void*);
+void            timer_del(struct timer*);
+void            timer_tick(void);
+void            timer_wakeup(void*);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            timeron(void);
+void            timeroff(void);
+void            sendipi(int);
 
 // uart.c
 void            uartinit(void);
@@ -173,16 +263,24 @@ int             uartgetc(void);
 void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
+pagetable_t     kvmcreate(pagetable_t);
+void            kvmsync(pagetable_t, pagetable_t);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+int             mapmega(pagetable_t, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
+uint64          uvmalloczero(pagetable_t, uint64, uint64, int);
+int             uvmborrow(pagetable_t, pagetable_t, uint64);
+void            uvmunborrow(pagetable_t);
+int             uvmdemote(pagetable_t, uint64);
+int             uvmpromote(pagetable_t, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
-void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         megapte(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -196,7 +294,10 @@ void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
-void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf *, int);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_rwpage(struct buf *, void *, uint, int);
+uint            virtio_disk_size(void);
 void            virtio_disk_intr(void);
 
 
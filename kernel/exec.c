@@ -6,6 +6,9 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
 
@@ -24,13 +27,18 @@ exec(char *path, char **argv)
 {
   char *s, *last;
   int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
+  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase, guard;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *execip = 0, *oldip;
   struct proghdr ph;
+  struct execseg seg[NEXECSEG];
+  int nseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
+  // the new image's page tables and stack need memory.
+  swapensure();
+
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -59,31 +67,63 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.vaddr + ph.memsz > MAXUVA)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    uint64 sz1, fend, zstart, memend = ph.vaddr + ph.memsz;
+    int perm = flags2perm(ph.flags);
+    // whole pages of file data are paged in from the page
+    // cache when first touched; see execfault().
+    fend = PGROUNDDOWN(ph.vaddr + ph.filesz);
+    if(fend > ph.vaddr){
+      if(nseg == NEXECSEG || ph.vaddr < sz)
+        goto bad;
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].end = fend;
+      seg[nseg].off = ph.off;
+      seg[nseg].perm = perm;
+      nseg++;
+      sz = fend;
+    }
+    // whole pages of writable bss share the zero page until written.
+    zstart = (perm & PTE_W) ? PGROUNDUP(ph.vaddr + ph.filesz) : memend;
+    if(zstart > sz){
+      if((sz1 = uvmalloc(pagetable, sz, zstart, perm)) == 0)
+        goto bad;
+      sz = sz1;
+    }
+    if(memend > sz){
+      if((sz1 = uvmalloczero(pagetable, sz, memend, perm)) == 0)
+        goto bad;
+      sz = sz1;
+    }
+    // the last, partial page of file data is read now.
+    if(ph.vaddr + ph.filesz > fend &&
+       loadseg(pagetable, fend, ip, ph.off + (fend - ph.vaddr), ph.vaddr + ph.filesz - fend) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  iexec(ip);
+  iunlock(ip);
   end_op();
+  execip = ip;
   ip = 0;
 
   p = myproc();
   uint64 oldsz = p->sz;
 
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible as a stack guard.
-  // Use the second as the user stack.
+  // Leave a page at the next page boundary unmapped, as a
+  // stack guard, and allocate the user stack above it. A PTE
+  // without PTE_U wouldn't do, since copy_user() runs with SUM.
   sz = PGROUNDUP(sz);
+  guard = sz;
+  sz += PGSIZE;
   uint64 sz1;
-  if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE, PTE_W)) == 0)
+  if(sz + PGSIZE > MAXUVA)
+    goto bad;
+  if((sz1 = uvmalloc(pagetable, sz, sz + PGSIZE, PTE_W)) == 0)
     goto bad;
   sz = sz1;
-  uvmclear(pagetable, sz-2*PGSIZE);
   sp = sz;
   stackbase = sp - PGSIZE;
 
@@ -120,13 +160,39 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
+  // The old image's mappings go with it.
+  mmapclear(p);
+
   // Commit to the user image.
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
+  p->guard = guard;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  oldip = p->execip;
+  p->execip = execip;
+  memmove(p->execseg, seg, sizeof(seg));
+  p->nexecseg = nseg;
+  if(p->vfork){
+    // the old memory was borrowed from our parent.
+    uvmunborrow(oldpagetable);
+    oldsz = 0;
+  }
+  // the TLB may hold entries for the old page table
+  // under our ASID; take a new one, and stop using the
+  // old one before it is freed.
+  kvmsync(p->kpagetable, pagetable);
+  p->asidgen = 0;
+  kvmswitch(p);
   proc_freepagetable(oldpagetable, oldsz);
+  if(p->vfork)
+    vforkdone(p);
+  if(oldip){
+    begin_op();
+    iexecput(oldip);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,9 +203,43 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(execip){
+    begin_op();
+    iexecput(execip);
+    end_op();
+  }
   return -1;
 }
 
+// Map the page at va of the current process's program from
+// the page cache, if exec() left it to be paged in. Text is
+// shared read-only, and data copy-on-write.
+// Returns 1 if it did, 0 if va isn't such a page, -1 on error.
+int
+execfault(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  struct execseg *s;
+  char *pa;
+  int perm;
+
+  for(s = p->execseg; s < &p->execseg[p->nexecseg]; s++){
+    if(va < s->va || va >= s->end)
+      continue;
+    if((pa = pcache_get(p->execip, s->off + (va - s->va))) == 0)
+      return -1;
+    perm = PTE_R | PTE_U | (s->perm & PTE_X);
+    if(s->perm & PTE_W)
+      perm |= PTE_COW;
+    if(mappages(pagetable, va, PGSIZE, (uint64)pa, perm) != 0){
+      kfree(pa);
+      return -1;
+    }
+    return 1;
+  }
+  return 0;
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
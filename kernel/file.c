@@ -14,15 +14,19 @@
 #include "proc.h"
 
 struct devsw devsw[NDEV];
+
+// Open files come from a slab cache, so there is no limit
+// on them but memory. ftable.lock protects their ref counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct slabcache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = slab_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -31,16 +35,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = slab_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +68,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  slab_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -118,10 +116,34 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    // read a page at a time into a page of the kernel's, and
+    // copy that out without the inode lock: the copy may fault
+    // on a mapping of this or another file, and page it in
+    // under its lock.
+    char *kbuf;
+    int i = 0, m;
+
+    swapensure();
+    if((kbuf = kalloc()) == 0)
+      return -1;
+    while(i < n){
+      m = n - i < PGSIZE ? n - i : PGSIZE;
+      ilock(f->ip);
+      if((r = readi(f->ip, 0, (uint64)kbuf, f->off, m)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+      if(r > 0 && copyout(myproc()->pagetable, addr + i, kbuf, r) < 0)
+        r = -1;
+      if(r < 0){
+        i = -1;
+        break;
+      }
+      i += r;
+      if(r < m)
+        break;
+    }
+    kfree(kbuf);
+    r = i;
   } else {
     panic("fileread");
   }
@@ -152,16 +174,24 @@ filewrite(struct file *f, uint64 addr, int n)
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
+    // the data is copied in first, as in fileread().
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
+    char *kbuf;
+
+    swapensure();
+    if((kbuf = kalloc()) == 0)
+      return -1;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
+      if(copyin(myproc()->pagetable, kbuf, addr + i, n1) < 0)
+        break;
 
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+      if ((r = writei(f->ip, 0, (uint64)kbuf, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
@@ -172,6 +202,7 @@ filewrite(struct file *f, uint64 addr, int n)
       }
       i += r;
     }
+    kfree(kbuf);
     ret = (i == n ? n : -1);
   } else {
     panic("filewrite");
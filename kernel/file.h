@@ -18,8 +18,15 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int npcache;        // Pages in the page cache; see pcache.c
+  int nexec;          // Processes running it as their program; see iexec()
+  struct inode *next; // itable list
+  struct inode *prev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint raoff;         // where a sequential read would go on
+  uint rawin;         // readahead window, in blocks; 0 if not sequential
+  uint raend;         // first block not yet read ahead
 
   short type;         // copy of disk inode
   short major;
@@ -169,24 +169,28 @@ bfree(int dev, uint b)
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold itable.lock while using any of those fields.
 //
+// The table grows as needed: entries come from a slab cache,
+// and are on the itable list while in use. An entry whose last
+// reference goes is freed, unless the page cache holds pages of
+// its i-node; up to NINODE of those stay on the list, unused,
+// so that running a program again finds its pages.
+//
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *list;   // all the entries
+  int nidle;            // entries on the list with ref 0
+  struct slabcache *cache;
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.cache = slab_create("inode", sizeof(struct inode));
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -252,25 +256,39 @@ iget(uint dev, uint inum)
 
   // Is the inode already in the table?
   empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.list; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      // an unused entry still has this inode's cached pages.
+      if(ip->ref++ == 0)
+        itable.nidle--;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
+    if(ip->ref == 0)
       empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Make a new entry or, if there is no memory for one,
+  // recycle an unused one.
+  if((ip = slab_alloc(itable.cache)) != 0){
+    memset(ip, 0, sizeof(*ip));
+    initsleeplock(&ip->lock, "inode");
+    ip->next = itable.list;
+    if(ip->next)
+      ip->next->prev = ip;
+    itable.list = ip;
+  } else if((ip = empty) != 0){
+    if(ip->npcache)
+      pcache_inval(ip);
+    itable.nidle--;
+  } else {
     panic("iget: no inodes");
-
-  ip = empty;
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->raoff = ip->rawin = ip->raend = 0;
   release(&itable.lock);
 
   return ip;
@@ -287,6 +305,31 @@ idup(struct inode *ip)
   return ip;
 }
 
+// ip is the program of one more process, which pages it in
+// from the file as it runs, so the file can't be written or
+// truncated until it is done: see iexecput(). Caller holds
+// ip->lock, or a reference from another such process.
+void
+iexec(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->nexec++;
+  release(&itable.lock);
+}
+
+// A process is done running ip, and drops its reference.
+// Must be inside a transaction, as for iput().
+void
+iexecput(struct inode *ip)
+{
+  acquire(&itable.lock);
+  if(ip->nexec < 1)
+    panic("iexecput");
+  ip->nexec--;
+  release(&itable.lock);
+  iput(ip);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -327,8 +370,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry is
+// freed, or kept for its cached pages.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -357,7 +400,21 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    if(ip->npcache && itable.nidle < NINODE){
+      itable.nidle++;
+    } else {
+      if(ip->npcache)
+        pcache_inval(ip);
+      if(ip->prev)
+        ip->prev->next = ip->next;
+      else
+        itable.list = ip->next;
+      if(ip->next)
+        ip->next->prev = ip->prev;
+      slab_free(itable.cache, ip);
+    }
+  }
   release(&itable.lock);
 }
 
@@ -421,7 +478,8 @@ bmap(struct inode *ip, uint bn)
 }
 
 // Truncate inode (discard contents).
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, and check that no process is
+// running it.
 void
 itrunc(struct inode *ip)
 {
@@ -429,6 +487,12 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  if(ip->nexec)
+    panic("itrunc: running program");
+
+  if(ip->npcache)
+    pcache_inval(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -464,6 +528,40 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// readi() is about to read n bytes at off. If ip is being read
+// sequentially, start reading the blocks it will want next, and
+// the ones it wants now, without waiting for them. The window
+// doubles with every sequential read, from RAMIN up to RAMAX
+// blocks, and closes on a read anywhere else. It never takes
+// more buffers than are spare, so it can't crowd out others.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint first = off / BSIZE, start, end, bn, addr;
+
+  if(off == ip->raoff){
+    ip->rawin = ip->rawin ? min(2 * ip->rawin, RAMAX) : RAMIN;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->raoff = off + n;
+  if(ip->rawin == 0)
+    return;
+
+  start = ip->raend > first ? ip->raend : first;
+  end = min((off + n + BSIZE - 1) / BSIZE + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  end = min(end, start + bspare());
+  blk_plug();  // a file's blocks are often adjacent on disk
+  for(bn = start; bn < end; bn++){
+    if((addr = bmap(ip, bn)) == 0 || breadahead(ip->dev, addr) < 0)
+      break;
+  }
+  blk_unplug();
+  if(bn > ip->raend)
+    ip->raend = bn;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -478,6 +576,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -512,6 +612,12 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  // a running program's pages not yet paged in would
+  // come from the new contents.
+  if(ip->nexec)
+    return -1;
+  if(ip->npcache)
+    pcache_inval(ip);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
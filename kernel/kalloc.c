@@ -1,6 +1,27 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages, or with
+// kalloc_order(), physically contiguous blocks of 2^order pages.
+//
+// Free memory is kept by a buddy allocator: kmem has a list of
+// free blocks for each order, each block aligned to its size,
+// and a freed block merges with its buddy, the other half of the
+// block of the next order up, whenever that is free too.
+//
+// Each cpu keeps a small cache of free pages, so kalloc() and
+// kfree() normally take only that cpu's uncontended lock. A cache
+// that runs dry refills KBATCH pages from kmem, and one that grows
+// past KCACHEMAX drains KBATCH pages back. If kmem has no pages
+// either, kalloc() steals a page from another cpu's cache.
+//
+// Idle cpus also keep a pool of zeroed pages, so that kzalloc()
+// usually needn't clear the page it returns. Built with
+// MEMMODE=POISON (the default), kalloc() and kfree() fill pages
+// with junk to catch uses of uninitialized or freed memory;
+// MEMMODE=NOPOISON leaves that out.
+//
+// Lock order: a cpu's kcache lock, then kmem.lock. Never hold
+// two kcache locks.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +30,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "kstats.h"
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -17,32 +39,62 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;   // used only on kmem's lists
 };
 
+#define KBATCH    32   // pages moved between a cpu cache and kmem at once
+#define KCACHEMAX 64   // most free pages a cpu cache holds
+
+#define NPAGE     ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PAGENO(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PAGEPA(n)  ((struct run*)(KERNBASE + (uint64)(n) * PGSIZE))
+#define BFREE     0x80 // in kmem.order[]: first page of a free block
+
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *freelist[MAXORDER + 1];  // free blocks of each order
+  int nblock[MAXORDER + 1];            // length of each list
+  int npage;                           // free pages in all the lists
+  uchar order[NPAGE];                  // BFREE|order, or 0
 } kmem;
 
-uint64 x = PGROUNDUP(PHYSTOP)>>12;
+#define KZEROMAX 256   // most pages kept zeroed for kzalloc()
 
 struct {
   struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+} kzero;
+
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+} kcache[NCPU];
+
+uint64 x = PGROUNDUP(PHYSTOP)>>12;
+
+struct kstats kstats;
+
+// A page of zeros, mapped copy-on-write wherever a process
+// gets fresh memory. It is never freed.
+void *zeropage;
+
+// The number of page table mappings and kernel users of
+// each physical page. Updated with atomic instructions,
+// so it needs no lock.
+struct {
   int count[PGROUNDUP(PHYSTOP)>>12];
 } pagereference;
 
 void init_pagereference(){
   int i = 0;
-  initlock(&pagereference.lock, "pagereference");
-
-  acquire(&pagereference.lock);
 
   while(i < x)
   {
    pagereference.count[i]=0;
     i++;
   }
-  release(&pagereference.lock);
 
 }
 
@@ -50,64 +102,121 @@ void init_pagereference(){
 void pagereference_decrease(void*pa){
   int count_var = (uint64)pa>>12;
 
-  acquire(&pagereference.lock);
-
-  int total_count = pagereference.count[count_var];
-
-  if(total_count <0){
-    panic("increase page reference");
+  if(__sync_sub_and_fetch(&pagereference.count[count_var], 1) < 0){
+    panic("decrease page reference");
   }
-  pagereference.count[count_var]--;
-  release(&pagereference.lock);
 }
 
 
 void pagereference_increase(void*pa){
   int count_var = (uint64)pa>>12;
 
-  acquire(&pagereference.lock);
-
-  int total_count = pagereference.count[count_var];
-
-  if(total_count <0){
+  if(__sync_fetch_and_add(&pagereference.count[count_var], 1) < 0){
     panic("increase page reference");
   }
-  pagereference.count[count_var]++;
-  release(&pagereference.lock);
 }
 
 int get_pagereference(void*pa)
 {
-  acquire(&pagereference.lock);
-
   uint64 count_var=(uint64)pa>>12;
-  int rvalue = pagereference.count[count_var];
+  int rvalue = __atomic_load_n(&pagereference.count[count_var], __ATOMIC_SEQ_CST);
 
   if(rvalue<0){
     panic("get page reference");
   }
-  release(&pagereference.lock);
 
   return rvalue;
 }
 
 
+// Is the MEGASIZE-aligned region around va all heap, below
+// p->sz and clear of the program's segments and stack guard?
+static int
+megaheap(struct proc *p, uint64 va)
+{
+  uint64 base = MEGAROUNDDOWN(va);
+
+  if(base + MEGASIZE > p->sz)
+    return 0;
+  if(p->guard >= base && p->guard < base + MEGASIZE)
+    return 0;
+  for(int i = 0; i < p->nexecseg; i++)
+    if(p->execseg[i].va < base + MEGASIZE && p->execseg[i].end > base)
+      return 0;
+  return 1;
+}
+
 int page_fault_handler(void*va,pagetable_t pagetable){
  
   pte_t *pte;
   uint64 pa;
   uint flags;
+  int r;
   struct proc* p = myproc();
-  int var1=PGROUNDDOWN(p->trapframe->sp)-PGSIZE;
 
-  if((uint64)va>=MAXVA || ((uint64)va>=var1 && (uint64)va<=(var1+PGSIZE)))
+  // the stack guard is below p->sz, but is never mapped.
+  if((uint64)va>=MAXVA || (p->guard && PGROUNDDOWN((uint64)va) == p->guard))
     return -2;
 
+  __sync_fetch_and_add(&kstats.faults, 1);
+
   va = (void*)PGROUNDDOWN((uint64)va);
+
+  // make room for what this fault may allocate.
+  swapensure();
+  if((pte = walk(pagetable, (uint64)va, 0)) != 0 && (*pte & PTE_SWAP))
+    return swapin(pte);
+
+  if((pte = megapte(pagetable, (uint64)va)) != 0 && (*pte & PTE_COW)){
+    // a write to a shared megapage. If the other processes
+    // have let go of every page in it, it's ours; if not,
+    // split it and copy just the page written.
+    pa = PTE2PA(*pte);
+    int i;
+    for(i = 0; i < (1 << MEGAORDER); i++)
+      if(get_pagereference((void*)(pa + i*PGSIZE)) != 1)
+        break;
+    if(i == (1 << MEGAORDER)){
+      *pte = (*pte | PTE_W) & ~PTE_COW;
+      tlb_flush(p, (uint64)va);
+      __sync_fetch_and_add(&kstats.cowreuses, 1);
+      return 0;
+    }
+    if(uvmdemote(pagetable, (uint64)va) < 0)
+      return -1;
+  }
+
+  if(pagetable == p->pagetable && (r = mmapfault(p, (uint64)va)) != 0)
+    return r < 0 ? -1 : 0;
+
   pte = walk(pagetable,(uint64)va,0);
 
-  if(!pte)
-    return -1;
+  if(!pte || (*pte & PTE_V) == 0)
+  {
+    // sbrk() only moves p->sz: a page of the heap
+    // gets memory when it is first touched, and so
+    // does a page of the program, from its file.
+    char *mem;
+
+    if(pagetable != p->pagetable || (uint64)va >= p->sz)
+      return -1;
+    if((r = execfault(pagetable, (uint64)va)) != 0)
+      return r < 0 ? -1 : 0;
+    // heap that spans a whole aligned 2MB becomes a megapage
+    // when its last page is touched.
+    if(megaheap(p, (uint64)va) && uvmpromote(pagetable, (uint64)va) == 0){
+      tlb_flushall(p);
+      return 0;
+    }
+    if((mem = kzalloc()) == 0)
+      return -1;
+    if(mappages(pagetable, (uint64)va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+      kfree(mem);
+      return -1;
+    }
+    __sync_fetch_and_add(&kstats.lazyfills, 1);
+    return 0;
+  }
 
   pa = PTE2PA(*pte);
 
@@ -121,20 +230,36 @@ int page_fault_handler(void*va,pagetable_t pagetable){
     
     flags = (flags|PTE_W);
     flags  = flags &(~PTE_COW);
-    mem = kalloc();
 
-    if(!mem)
-      return -1;
+    if((void*)pa == zeropage){
+      // first write to fresh memory.
+      if((mem = kzalloc()) == 0)
+        return -1;
+      __sync_fetch_and_add(&kstats.zerofills, 1);
+    } else if(get_pagereference((void*)pa) == 1){
+      // the processes that shared the page are gone:
+      // it's ours, so just let us write it.
+      *pte = PA2PTE(pa) | flags;
+      tlb_flush(p, (uint64)va);
+      __sync_fetch_and_add(&kstats.cowreuses, 1);
+      return 0;
+    } else {
+      if((mem = kalloc()) == 0)
+        return -1;
+      memmove(mem,(void*)pa,PGSIZE);
+      __sync_fetch_and_add(&kstats.cowcopies, 1);
+    }
 
-    memmove(mem,(void*)pa,PGSIZE);
     *pte = PA2PTE(mem);
     *pte=(*pte) | flags;
+    tlb_flush(p, (uint64)va);
     
     kfree((void*)pa);
     return 0;
   }
 
-  return 0;
+  // the page is mapped, but not for this kind of access.
+  return -1;
 }
 
 
@@ -142,21 +267,103 @@ void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  initlock(&kzero.lock, "kzero");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
   init_pagereference();
 
   freerange(end, (void*)PHYSTOP);
+
+  if((zeropage = kalloc()) == 0)
+    panic("kinit");
+  memset(zeropage, 0, PGSIZE);
+}
+
+static void
+buddy_push(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.order[PAGENO(r)] = BFREE | order;
+  kmem.nblock[order]++;
+  kmem.npage += 1 << order;
+}
+
+static void
+buddy_unlink(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.order[PAGENO(r)] = 0;
+  kmem.nblock[order]--;
+  kmem.npage -= 1 << order;
+}
+
+// Take a free block of 2^order pages, splitting a
+// bigger one if need be. Caller must hold kmem.lock.
+static struct run*
+buddy_alloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER && kmem.freelist[k] == 0; k++)
+    ;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.freelist[k];
+  buddy_unlink(r, k);
+  // give back the upper halves.
+  while(k > order){
+    k--;
+    buddy_push(PAGEPA(PAGENO(r) + (1 << k)), k);
+  }
+  return r;
+}
+
+// Free the block of 2^order pages at r, merging it with its
+// buddies as far as they are free. Caller must hold kmem.lock.
+static void
+buddy_free(struct run *r, int order)
+{
+  uint64 n = PAGENO(r), b;
+
+  while(order < MAXORDER){
+    b = n ^ (1 << order);
+    if(b >= NPAGE || kmem.order[b] != (BFREE | order))
+      break;
+    buddy_unlink(PAGEPA(b), order);
+    n &= ~(uint64)(1 << order);
+    order++;
+  }
+  buddy_push(PAGEPA(n), order);
 }
 
 void
 freerange(void *pa_start, void *pa_end)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-  {    pagereference_increase(p);
+  uint64 n, last;
+  int order;
 
-    kfree(p);
+  n = PAGENO(PGROUNDUP((uint64)pa_start));
+  last = PAGENO(PGROUNDDOWN((uint64)pa_end));
+  acquire(&kmem.lock);
+  while(n < last){
+    // the biggest aligned block that fits.
+    for(order = MAXORDER; order > 0; order--)
+      if((n & ((1 << order) - 1)) == 0 && n + (1 << order) <= last)
+        break;
+    buddy_free(PAGEPA(n), order);
+    n += 1 << order;
   }
+  release(&kmem.lock);
 }
 
 // Free the page of physical memory pointed at by pa,
@@ -166,8 +373,8 @@ freerange(void *pa_start, void *pa_end)
 void
 kfree(void *pa)
 {
-
   struct run *r;
+  struct kcache *c;
 
   int count_var = (uint64)pa>>12;
 
@@ -175,31 +382,78 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
-  acquire(&pagereference.lock);
-
-   int total_count = pagereference.count[count_var];
-  if(total_count <=0){
+  int total_count = __sync_sub_and_fetch(&pagereference.count[count_var], 1);
+  if(total_count < 0){
     panic("decrease page reference");
   }
-
-  pagereference.count[count_var]--;
-
-  total_count--;
-  if(total_count>0){
-    release(&pagereference.lock);
+  if(total_count > 0){
     return;
   }
-  release(&pagereference.lock);
 
+#ifdef POISON
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  c = &kcache[cpuid()];
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  if(++c->nfree > KCACHEMAX){
+    acquire(&kmem.lock);
+    for(int i = 0; i < KBATCH; i++){
+      r = c->freelist;
+      c->freelist = r->next;
+      buddy_free(r, 0);
+    }
+    c->nfree -= KBATCH;
+    release(&kmem.lock);
+  }
+  release(&c->lock);
+  pop_off();
+}
+
+// Take a page from some other cpu's cache, when
+// this cpu's cache and kmem are both empty.
+static struct run*
+ksteal(int me)
+{
+  struct kcache *c;
+  struct run *r;
+
+  for(int i = 1; i < NCPU; i++){
+    c = &kcache[(me + i) % NCPU];
+    acquire(&c->lock);
+    if((r = c->freelist) != 0){
+      c->freelist = r->next;
+      c->nfree--;
+    }
+    release(&c->lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
+// Take a page from the zeroed pool, or return 0 if it
+// is empty. The page is already referenced once.
+static struct run*
+kzero_take(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  if((r = kzero.freelist) != 0){
+    kzero.freelist = r->next;
+    kzero.nfree--;
+  }
+  release(&kzero.lock);
+  if(r)
+    r->next = 0;  // the only word that wasn't zero
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -209,18 +463,279 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
+  int id;
+
+  push_off();
+  id = cpuid();
+  c = &kcache[id];
+  acquire(&c->lock);
+  if(c->freelist == 0){
+    acquire(&kmem.lock);
+    for(int i = 0; i < KBATCH && (r = buddy_alloc(0)) != 0; i++){
+      r->next = c->freelist;
+      c->freelist = r;
+      c->nfree++;
+    }
+    release(&kmem.lock);
+  }
+  r = c->freelist;
+  if(r){
+    c->freelist = r->next;
+    c->nfree--;
+  }
+  release(&c->lock);
+  if(r == 0)
+    r = ksteal(id);
+  pop_off();
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  if(r == 0)
+    return kzero_take();  // already referenced
 
   if(r)
   {
-    memset((char*)r, 5, PGSIZE);
+#ifdef POISON
+    memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
     pagereference_increase((void*)r);
 
-  } // fill with junk
+  }
+  return (void*)r;
+}
+
+// Allocate one zeroed page, if possible from the pool
+// that idle cpus fill. Returns 0 if out of memory.
+void *
+kzalloc(void)
+{
+  struct run *r;
+
+  if((r = kzero_take()) != 0)
+    return (void*)r;
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Zero a free page ahead of time for kzalloc().
+// Called from scheduler() by cpus that have nothing
+// to run. Returns 0 if there is nothing to do.
+int
+kzero_fill(void)
+{
+  struct run *r;
+
+  // keep the last free pages for kalloc().
+  if(*(volatile int*)&kzero.nfree >= KZEROMAX ||
+     *(volatile int*)&kmem.npage == 0)
+    return 0;
+  if((r = kalloc()) == 0)
+    return 0;
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  r->next = kzero.freelist;
+  kzero.freelist = r;
+  kzero.nfree++;
+  release(&kzero.lock);
+  return 1;
+}
+
+// Give the pages in every cpu's cache, and in the zeroed
+// pool, back to kmem, where they can merge with their buddies
+// into blocks for kalloc_order().
+static void
+kdrain(void)
+{
+  struct kcache *c;
+  struct run *r, *zeroed;
+
+  for(int i = 0; i < NCPU; i++){
+    c = &kcache[i];
+    acquire(&c->lock);
+    acquire(&kmem.lock);
+    while((r = c->freelist) != 0){
+      c->freelist = r->next;
+      buddy_free(r, 0);
+    }
+    c->nfree = 0;
+    release(&kmem.lock);
+    release(&c->lock);
+  }
+
+  acquire(&kzero.lock);
+  zeroed = kzero.freelist;
+  kzero.freelist = 0;
+  kzero.nfree = 0;
+  release(&kzero.lock);
+  acquire(&kmem.lock);
+  while((r = zeroed) != 0){
+    zeroed = r->next;
+    pagereference_decrease((void*)r);  // kalloc() referenced it
+    buddy_free(r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. The block is freed with kfree_order().
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_order(int order)
+{
+  struct run *r;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    return 0;
+
+  acquire(&kmem.lock);
+  r = buddy_alloc(order);
+  release(&kmem.lock);
+  if(r == 0){
+    // free pages may be sitting in the cpu caches or the
+    // zeroed pool, or memory may be low enough to swap.
+    swapensure();
+    kdrain();
+    acquire(&kmem.lock);
+    r = buddy_alloc(order);
+    release(&kmem.lock);
+  }
+
+  if(r){
+#ifdef POISON
+    memset((char*)r, 5, PGSIZE << order); // fill with junk
+#endif
+    pagereference_increase((void*)r);
+  }
   return (void*)r;
 }
+
+// Free a block returned by kalloc_order(order).
+void
+kfree_order(void *pa, int order)
+{
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order > MAXORDER || (char*)pa < end ||
+     PAGENO(pa) % (1 << order) != 0 || (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
+
+  int total_count = __sync_sub_and_fetch(&pagereference.count[(uint64)pa>>12], 1);
+  if(total_count < 0)
+    panic("decrease page reference");
+  if(total_count > 0)
+    return;
+
+#ifdef POISON
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  buddy_free((struct run*)pa, order);
+  release(&kmem.lock);
+}
+
+// Allocate a block for a megapage: 2^MEGAORDER pages aligned to
+// MEGASIZE, not zeroed. Unlike kalloc_order(), every page of the
+// block is referenced once, so that once the megapage is split
+// its pages can be shared and freed one at a time. Free it with
+// kfree_mega(), or page by page with kfree().
+void *
+kalloc_mega(void)
+{
+  char *pa;
+
+  if((pa = kalloc_order(MEGAORDER)) == 0)
+    return 0;
+  for(int i = 1; i < (1 << MEGAORDER); i++)
+    pagereference_increase(pa + i*PGSIZE);
+  return pa;
+}
+
+// Drop one reference to each page of the megapage-sized block
+// at pa, and free the pages nobody references any more, as one
+// block if they all are.
+void
+kfree_mega(void *pa)
+{
+  uint64 unused[(1 << MEGAORDER) / 64];
+  int n, nunused = 0;
+
+  if(((uint64)pa % MEGASIZE) != 0 || (char*)pa < end || (uint64)pa + MEGASIZE > PHYSTOP)
+    panic("kfree_mega");
+
+  memset(unused, 0, sizeof(unused));
+  for(int i = 0; i < (1 << MEGAORDER); i++){
+    n = __sync_sub_and_fetch(&pagereference.count[((uint64)pa>>12) + i], 1);
+    if(n < 0)
+      panic("decrease page reference");
+    if(n == 0){
+      unused[i / 64] |= 1L << (i % 64);
+      nunused++;
+    }
+  }
+  if(nunused == 0)
+    return;
+
+  acquire(&kmem.lock);
+  if(nunused == (1 << MEGAORDER)){
+#ifdef POISON
+    memset(pa, 1, MEGASIZE);
+#endif
+    buddy_free((struct run*)pa, MEGAORDER);
+  } else {
+    for(int i = 0; i < (1 << MEGAORDER); i++){
+      if(unused[i / 64] & (1L << (i % 64))){
+#ifdef POISON
+        memset((char*)pa + i*PGSIZE, 1, PGSIZE);
+#endif
+        buddy_free((struct run*)((char*)pa + i*PGSIZE), 0);
+      }
+    }
+  }
+  release(&kmem.lock);
+}
+
+// Return the number of free pages.
+int
+kfreepages(void)
+{
+  int n;
+
+  n = *(volatile int*)&kmem.npage + *(volatile int*)&kzero.nfree;
+  for(int i = 0; i < NCPU; i++)
+    n += *(volatile int*)&kcache[i].nfree;
+  return n;
+}
+
+// Print free memory and how fragmented it is.
+// Called from procdump().
+void
+kmemdump(void)
+{
+  int order, big = -1, cached = 0, zeroed;
+
+  for(int i = 0; i < NCPU; i++)
+    cached += *(volatile int*)&kcache[i].nfree;
+  zeroed = *(volatile int*)&kzero.nfree;
+
+  acquire(&kmem.lock);
+  printf("free pages: %d buddy, %d cpu caches, %d zeroed\n",
+         kmem.npage, cached, zeroed);
+  printf("free blocks by order:");
+  for(order = 0; order <= MAXORDER; order++){
+    printf(" %d", kmem.nblock[order]);
+    if(kmem.nblock[order])
+      big = order;
+  }
+  printf("\n");
+  // how much of the free memory is in blocks smaller than the largest.
+  if(kmem.npage > 0)
+    printf("largest block: order %d, fragmentation %d%%\n", big,
+           100 - (kmem.nblock[big] << big) * 100 / kmem.npage);
+  release(&kmem.lock);
+}
@@ -0,0 +1,50 @@
+// Kernel event counters, copied out by the kstats() system call.
+struct kstats {
+  uint64 faults;       // Page faults handled
+  uint64 cowcopies;    // COW faults that copied a shared page
+  uint64 cowreuses;    // COW faults that took over a page nobody else maps
+  uint64 zeromaps;     // Pages mapped to the shared zero page
+  uint64 zerofills;    // Zero page faults that got a page of their own
+  uint64 lazyfills;    // Heap pages allocated when first touched
+  uint64 pcachehits;   // Program pages found in the page cache
+  uint64 pcachemisses; // Program pages read from the file
+  uint64 megapromotes; // Heap megapages made from pages already mapped
+  uint64 megademotes;  // Megapages split into pages for COW or unmap
+  uint64 tlbflushes;   // Whole-TLB flushes on returns to user space
+  uint64 asidflushes;  // Flushes of one process's TLB entries
+  uint64 asidrollovers; // Times the ASIDs ran out and were recycled
+  uint64 mmapfills;    // mmap() pages mapped when first touched
+  uint64 mmapwrites;   // Dirty shared mmap() pages written back
+  uint64 swapouts;     // Pages written to swap
+  uint64 swapins;      // Pages read back from swap
+  uint64 swapscans;    // PTEs the reclaimer's clock hand looked at
+  uint64 swapfails;    // Times memory was low and nothing could be evicted
+  uint64 bcachehits;   // Blocks found in the buffer cache
+  uint64 bcachemisses; // Blocks given a recycled buffer
+  uint64 bcachespins;  // Buffer cache lock acquires that had to wait
+  uint64 bcacheevicts; // Cached blocks whose buffer was recycled
+  uint64 bcacheshrinks; // Buffer cache pages given back when memory was low
+  uint64 readaheads;   // Blocks readi() read ahead
+  uint64 rahits;       // Blocks read ahead that were then asked for
+  uint64 diskreqs;     // Requests given to the disk
+  uint64 diskqdepth;   // Sum over requests of those in flight, with it
+  uint64 diskmerges;   // Blocks merged into another block's disk request
+  uint64 freepages;    // Free physical pages
+  uint64 swapfree;     // Free pages of swap
+  uint64 swappages;    // Pages of swap
+  uint64 bcachepages;  // Pages the buffer cache holds
+  uint64 asids;        // ASIDs the harts have, or 0 if none
+};
+
+// One slab allocator cache's usage, copied out by slabinfo().
+struct slabinfo {
+  char name[16];
+  uint size;           // Object size in bytes
+  uint perslab;        // Objects per page
+  uint slabs;          // Pages the cache holds
+  uint inuse;          // Objects allocated
+  uint cached;         // Free objects in the per-CPU magazines
+  uint64 allocs;       // Objects allocated, ever
+  uint64 frees;        // Objects freed, ever
+  uint64 misses;       // Magazine refills and flushes
+};
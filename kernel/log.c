@@ -28,7 +28,9 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous, though the blocks of a commit
+// are written to the disk all at once, not one after another,
+// and blk.c merges adjacent ones into one request.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -69,16 +71,22 @@ static void
 install_trans(int recovering)
 {
   int tail;
+  struct buf *dbuf[LOGSIZE];
 
+  blk_plug();  // so that adjacent blocks go in one request
   for (tail = 0; tail < log.lh.n; tail++) {
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
+    dbuf[tail] = bread(log.dev, log.lh.block[tail]); // read dst
+    memmove(dbuf[tail]->data, lbuf->data, BSIZE);  // copy block to dst
+    bwritestart(dbuf[tail]);  // start writing dst to disk
     brelse(lbuf);
-    brelse(dbuf);
+  }
+  blk_unplug();
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(dbuf[tail]);
+    if(recovering == 0)
+      bunpin(dbuf[tail]);
+    brelse(dbuf[tail]);
   }
 }
 
@@ -179,14 +187,20 @@ static void
 write_log(void)
 {
   int tail;
+  struct buf *to[LOGSIZE];
 
+  blk_plug();  // the log is contiguous: one request, mostly
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
+    to[tail] = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    memmove(to[tail]->data, from->data, BSIZE);
+    bwritestart(to[tail]);  // start writing the log
     brelse(from);
-    brelse(to);
+  }
+  blk_unplug();
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(to[tail]);
+    brelse(to[tail]);
   }
 }
 
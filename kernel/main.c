@@ -11,22 +11,29 @@ void
 main()
 {
   if(cpuid() == 0){
+    // paging goes on first: the kernel page table
+    // maps the uart where the console expects it.
+    kinit();         // physical page allocator
+    slabinit();      // kernel object caches
+    kvminit();       // create kernel page table
+    kvminithart();   // turn on paging
     consoleinit();
     printfinit();
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
-    kinit();         // physical page allocator
-    kvminit();       // create kernel page table
-    kvminithart();   // turn on paging
+    asidinit();      // address space identifiers
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    blkinit();       // block I/O queue
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipes
+    pcacheinit();    // executable page cache
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -35,8 +42,9 @@ main()
     while(started == 0)
       ;
     __sync_synchronize();
-    printf("hart %d starting\n", cpuid());
     kvminithart();    // turn on paging
+    printf("hart %d starting\n", cpuid());
+    asidinithart();   // check this hart's ASIDs
     trapinithart();   // install kernel trap vector
     plicinithart();   // ask PLIC for device interrupts
   }
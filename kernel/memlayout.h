@@ -27,6 +27,7 @@
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -41,6 +42,14 @@
 #define PLIC_MCLAIM(hart) (PLIC + 0x200004 + (hart)*0x2000)
 #define PLIC_SCLAIM(hart) (PLIC + 0x201004 + (hart)*0x2000)
 
+// the kernel maps the device registers above at DEVVA(pa),
+// not at their physical addresses, to keep its page tables
+// clear of the low addresses where user memory is (see
+// MAXUVA). machine mode, which doesn't page, uses the
+// physical addresses.
+#define DEVBASE 0xC0000000L
+#define DEVVA(pa) (DEVBASE + (uint64)(pa))
+
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
 // from physical address 0x80000000 to PHYSTOP.
@@ -52,8 +61,11 @@
 #define TRAMPOLINE (MAXVA - PGSIZE)
 
 // map kernel stacks beneath the trampoline,
-// each surrounded by invalid guard pages.
-#define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
+// each surrounded by invalid guard pages. the two pages
+// below the trampoline are left alone, since the kernel
+// shares its TLB entries with the user page table, which
+// has the trapframe there.
+#define KSTACK(p) (TRAMPOLINE - ((p)+2)* 2*PGSIZE)
 
 // User memory layout.
 // Address zero first:
@@ -65,3 +77,7 @@
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// user memory lies below MAXUVA. each process's kernel page
+// table maps it too, so the kernel can get at it directly.
+#define MAXUVA (1L << 30)
@@ -0,0 +1,360 @@
+// Memory-mapped files and anonymous memory: mmap() and munmap().
+//
+// Each process has up to NVMA mappings, each a page-aligned
+// range of its address space above the heap and below MAXUVA,
+// handed out from the top down. Nothing is mapped by mmap()
+// itself: mmapfault() fills in a page when it is first touched.
+//
+// File pages come from the page cache (pcache.c), so processes
+// that map the same file share its pages, and reading a mapped
+// file costs no copies. A MAP_PRIVATE mapping maps them
+// copy-on-write. A MAP_SHARED one maps them read-only at first,
+// and makes a page writable and dirty on its first write;
+// munmap() and exit() write dirty pages back to the file, up to
+// its current size. Anonymous pages are zeroed.
+//
+// fork() gives the child the same mappings: a MAP_SHARED one
+// shares its pages, all faulted in first so that parent and
+// child can't fill the same page separately, and a MAP_PRIVATE
+// one shares them copy-on-write.
+//
+// Only the process itself looks at its mappings, except for
+// fork(), when the parent is the one running.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "kstats.h"
+#include "proc.h"
+#include "defs.h"
+
+static int
+vmaused(struct vma *v)
+{
+  return v->start < v->end;
+}
+
+// The mapping of p that va is in, or 0.
+struct vma*
+mmapfind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(vmaused(v) && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// The lowest address p has mapped, or MAXUVA:
+// the heap can grow up to here.
+uint64
+mmapbase(struct proc *p)
+{
+  uint64 base = MAXUVA;
+
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++)
+    if(vmaused(v) && v->start < base)
+      base = v->start;
+  return base;
+}
+
+// The highest page-aligned address at which len bytes fit
+// between p's heap and MAXUVA without overlapping another
+// mapping, or 0. Only the top of the free stretches need be
+// tried: MAXUVA, and the start of each mapping.
+static uint64
+mmapspace(struct proc *p, uint64 len)
+{
+  uint64 best = 0, end, start;
+  struct vma *v, *w;
+
+  for(v = p->vma; v <= &p->vma[NVMA]; v++){
+    if(v == &p->vma[NVMA])
+      end = MAXUVA;
+    else if(vmaused(v))
+      end = v->start;
+    else
+      continue;
+    if(end < len || (start = end - len) < PGROUNDUP(p->sz) || start <= best)
+      continue;
+    for(w = p->vma; w < &p->vma[NVMA]; w++)
+      if(vmaused(w) && w->start < end && start < w->end)
+        break;
+    if(w == &p->vma[NVMA])
+      best = start;
+  }
+  return best;
+}
+
+static struct vma*
+vmaalloc(struct proc *p)
+{
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++)
+    if(!vmaused(v))
+      return v;
+  return 0;
+}
+
+// Map len bytes of f from offset off, or anonymous memory if
+// f is 0, into the current process. Returns the address, or
+// -1 on error.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 start;
+
+  // a vfork() child can't change the memory it borrows, and
+  // doesn't see the parent's mappings to keep clear of.
+  if(p->vfork)
+    return -1;
+  if(len == 0 || len > MAXUVA || off % PGSIZE != 0)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if(f){
+    if(f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+  len = PGROUNDUP(len);
+  if((start = mmapspace(p, len)) == 0 || (v = vmaalloc(p)) == 0)
+    return -1;
+  v->start = start;
+  v->end = start + len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->off = f ? off : 0;
+  return start;
+}
+
+// Read the page at offset off of ip into a page of its own,
+// zero past the end of the file. For the last page of a file,
+// which the page cache only holds whole pages of.
+static char*
+mmapread(struct inode *ip, uint off)
+{
+  char *mem;
+  int r;
+
+  if((mem = kzalloc()) == 0)
+    return 0;
+  ilock(ip);
+  r = readi(ip, 0, (uint64)mem, off, PGSIZE);
+  iunlock(ip);
+  if(r < 0){
+    kfree(mem);
+    return 0;
+  }
+  return mem;
+}
+
+// Handle a page fault at va in p's memory. Returns 1 if va is
+// in one of p's mappings and is now mapped, -1 if it can't be,
+// and 0 if va isn't mapped by mmap() or the fault is a write to
+// a copy-on-write page, which page_fault_handler() deals with.
+int
+mmapfault(struct proc *p, uint64 va)
+{
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  if((v = mmapfind(p, va)) == 0)
+    return 0;
+  va = PGROUNDDOWN(va);
+
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    if(*pte & PTE_COW)
+      return 0;
+    // the first write to a page of a shared mapping.
+    if((v->flags & MAP_SHARED) && (v->prot & PROT_WRITE) && (*pte & PTE_W) == 0){
+      *pte |= PTE_W | PTE_D;
+      tlb_flush(p, va);
+      return 1;
+    }
+    return -1;
+  }
+
+  if(v->prot == PROT_NONE)
+    return -1;
+  perm = PTE_U | PTE_R;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(v->f == 0){
+    if((mem = kzalloc()) == 0)
+      return -1;
+    if(v->prot & PROT_WRITE)
+      perm |= PTE_W;
+  } else {
+    uint off = v->off + (va - v->start);
+    if((mem = pcache_get(v->f->ip, off)) == 0 &&
+       (mem = mmapread(v->f->ip, off)) == 0)
+      return -1;
+    if((v->prot & PROT_WRITE) && (v->flags & MAP_PRIVATE))
+      perm |= PTE_COW;
+  }
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  __sync_fetch_and_add(&kstats.mmapfills, 1);
+  return 1;
+}
+
+// Write the page of v at va, at pa, back to v's file,
+// as filewrite() would, without growing the file.
+static void
+mmapwrite(struct vma *v, uint64 va, char *pa)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->start);
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i, n, r;
+
+  for(i = 0; i < PGSIZE; i += n){
+    n = PGSIZE - i;
+    if(n > max)
+      n = max;
+    begin_op();
+    ilock(ip);
+    if(off + i >= ip->size){
+      iunlock(ip);
+      end_op();
+      break;
+    }
+    if(n > ip->size - (off + i))
+      n = ip->size - (off + i);
+    r = writei(ip, 0, (uint64)pa + i, off + i, n);
+    iunlock(ip);
+    end_op();
+    if(r != n)
+      break;
+  }
+  __sync_fetch_and_add(&kstats.mmapwrites, 1);
+}
+
+// Unmap [start, end) of v, which must be at one end of v,
+// writing back dirty pages of a shared file mapping.
+static void
+mmapunmap(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 va;
+  pte_t *pte;
+
+  if(v->f && (v->flags & MAP_SHARED)){
+    for(va = start; va < end; va += PGSIZE){
+      if((pte = walk(p->pagetable, va, 0)) != 0 &&
+         (*pte & PTE_V) && (*pte & PTE_D))
+        mmapwrite(v, va, (char*)PTE2PA(*pte));
+    }
+  }
+  uvmunmap(p->pagetable, start, (end - start) / PGSIZE, 1);
+  tlb_flushall(p);
+
+  if(start == v->start){
+    v->off += end - start;
+    v->start = end;
+  } else {
+    v->end = start;
+  }
+  if(!vmaused(v)){
+    if(v->f)
+      fileclose(v->f);
+    v->f = 0;
+    v->start = v->end = 0;
+  }
+}
+
+// Unmap the pages of [addr, addr+len) from the current process.
+// They must all be in one mapping; a hole in the middle of one
+// splits it in two.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+  uint64 end;
+
+  if(p->vfork)
+    return -1;
+  if(addr % PGSIZE != 0 || len == 0 || len > MAXUVA)
+    return -1;
+  end = PGROUNDUP(addr + len);
+  if((v = mmapfind(p, addr)) == 0 || end > v->end)
+    return -1;
+  if(addr > v->start && end < v->end){
+    if((nv = vmaalloc(p)) == 0)
+      return -1;
+    *nv = *v;
+    nv->off += end - v->start;
+    nv->start = end;
+    if(nv->f)
+      filedup(nv->f);
+    v->end = end;
+  }
+  mmapunmap(p, v, addr, end);
+  return 0;
+}
+
+// Unmap all of p's mappings, for exit() and exec().
+void
+mmapclear(struct proc *p)
+{
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++)
+    if(vmaused(v))
+      mmapunmap(p, v, v->start, v->end);
+}
+
+// Fault in all the pages of p's shared mappings, so that
+// fork() can share them. Called before fork() holds locks,
+// since reading a file page may sleep.
+int
+mmapprefault(struct proc *p)
+{
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!vmaused(v) || (v->flags & MAP_SHARED) == 0 || v->prot == PROT_NONE)
+      continue;
+    for(uint64 va = v->start; va < v->end; va += PGSIZE)
+      if(walkaddr(p->pagetable, va) == 0 && page_fault_handler((void*)va, p->pagetable) < 0)
+        return -1;
+  }
+  return 0;
+}
+
+// Give np, a child of p being forked, p's mappings.
+// Returns 0 on success, -1 if out of memory.
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(vmaused(v) &&
+       uvmcopy(p->pagetable, np->pagetable, v->start, v->end, v->flags & MAP_SHARED) < 0)
+      goto err;
+  }
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    np->vma[v - p->vma] = *v;
+    if(v->f)
+      filedup(v->f);
+  }
+  return 0;
+
+ err:
+  while(v-- > p->vma)
+    if(vmaused(v))
+      uvmunmap(np->pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+  return -1;
+}
@@ -1,15 +1,28 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // unused in-memory i-nodes kept for their cached pages
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*3)  // fewest buffers in the disk block cache
+#define BCACHEPCT    10  // most of memory, in percent, the block cache may use
+#define RAMIN        4   // blocks readi() first reads ahead of a sequential read
+#define RAMAX        32  // most blocks readi() reads ahead
+#define MAXSEG       32  // most blocks merged into one disk request, < NUM-2
+#define NBUCKET      251 // buffer cache hash buckets
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define AGING        64
-#define NUMQ         5
\ No newline at end of file
+#define NUMQ         5
+#define NSLEEPQ      64  // wait channel hash buckets, a power of two
+#define MAXORDER     10  // largest kalloc_order() block is 2^MAXORDER pages
+#define NPCACHE      256 // executable file pages kept in the page cache
+#define NEXECSEG     4   // demand-paged segments per program
+#define NVMA         16  // mmap() mappings per process
+#define NSWAP        8192 // most pages of swap used, past the file system
+#define SWAPLOW      64  // evict pages when fewer are free
+#define SWAPBATCH    32  // pages to evict at a time
+#define NSLAB        16  // slab allocator object caches
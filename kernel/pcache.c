@@ -0,0 +1,166 @@
+// Page cache for the text and data of executables.
+//
+// exec() doesn't read a program into memory. The whole pages of
+// its file data are mapped when first touched, see execfault(),
+// from this cache of file pages, so all the processes running
+// the same program share one copy of its text, and its data
+// until they write it.
+//
+// Entries are keyed by in-memory inode and file offset, and hold
+// a reference to their page. writei() and itrunc() drop an
+// inode's pages, and so do iget() and iput() before they reuse
+// or free the inode's table entry. Processes that already map a
+// dropped page keep it. When the cache is full, a clock hand
+// picks the entry to replace, preferring pages nobody maps.
+//
+// Lock order: ip->lock, then pcache.lock.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "file.h"
+#include "kstats.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NPCBUCKET 64
+
+struct pcpage {
+  struct inode *ip;     // 0 if the entry is free
+  uint off;             // file offset of the page
+  char *pa;
+  struct pcpage *next;  // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  struct pcpage *bucket[NPCBUCKET];
+  int hand;
+} pcache;
+
+static struct pcpage**
+pc_bucket(struct inode *ip, uint off)
+{
+  return &pcache.bucket[((uint64)ip / sizeof(*ip) + off / PGSIZE) % NPCBUCKET];
+}
+
+static struct pcpage*
+pc_lookup(struct inode *ip, uint off)
+{
+  struct pcpage *e;
+
+  for(e = *pc_bucket(ip, off); e; e = e->next)
+    if(e->ip == ip && e->off == off)
+      return e;
+  return 0;
+}
+
+// Drop entry e. Caller must hold pcache.lock.
+static void
+pc_drop(struct pcpage *e)
+{
+  struct pcpage **pp;
+
+  for(pp = pc_bucket(e->ip, e->off); *pp != e; pp = &(*pp)->next)
+    ;
+  *pp = e->next;
+  e->ip->npcache--;
+  e->ip = 0;
+  kfree(e->pa);
+}
+
+// Find an entry to fill. Caller must hold pcache.lock.
+static struct pcpage*
+pc_victim(void)
+{
+  struct pcpage *e;
+
+  for(int i = 0; i < 2*NPCACHE; i++){
+    e = &pcache.page[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    // in the second sweep, take any entry.
+    if(e->ip == 0 || i >= NPCACHE || get_pagereference(e->pa) == 1)
+      break;
+  }
+  if(e->ip)
+    pc_drop(e);
+  return e;
+}
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Return the page at offset off, page aligned, of ip's file,
+// with a reference for the caller. Reads the page if it isn't
+// cached. ip must not be locked. Returns 0 on error.
+char*
+pcache_get(struct inode *ip, uint off)
+{
+  struct pcpage *e;
+  char *pa;
+
+  acquire(&pcache.lock);
+  if((e = pc_lookup(ip, off)) != 0){
+    pa = e->pa;
+    pagereference_increase(pa);
+    release(&pcache.lock);
+    __sync_fetch_and_add(&kstats.pcachehits, 1);
+    return pa;
+  }
+  release(&pcache.lock);
+
+  // nothing copies user memory, which may fault its way here,
+  // while holding an inode lock or a spinlock; see fileread().
+  if((pa = kalloc()) == 0)
+    return 0;
+  __sync_fetch_and_add(&kstats.pcachemisses, 1);
+
+  // hold ip->lock until the page is in the cache, so that a
+  // writei() either finds it there to drop or comes after.
+  ilock(ip);
+  if(readi(ip, 0, (uint64)pa, off, PGSIZE) != PGSIZE){
+    iunlock(ip);
+    kfree(pa);
+    return 0;
+  }
+  acquire(&pcache.lock);
+  if((e = pc_lookup(ip, off)) != 0){
+    // someone else read it meanwhile.
+    kfree(pa);
+    pa = e->pa;
+  } else {
+    e = pc_victim();
+    e->ip = ip;
+    e->off = off;
+    e->pa = pa;
+    e->next = *pc_bucket(ip, off);
+    *pc_bucket(ip, off) = e;
+    ip->npcache++;
+  }
+  pagereference_increase(pa);
+  release(&pcache.lock);
+  iunlock(ip);
+  return pa;
+}
+
+// Drop the cached pages of ip, whose contents are changing or
+// whose table entry is being reused. Caller must hold ip->lock
+// or be iget() reusing the entry.
+void
+pcache_inval(struct inode *ip)
+{
+  struct pcpage *e;
+
+  acquire(&pcache.lock);
+  for(e = pcache.page; ip->npcache > 0 && e < &pcache.page[NPCACHE]; e++)
+    if(e->ip == ip)
+      pc_drop(e);
+  release(&pcache.lock);
+}
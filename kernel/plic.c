@@ -12,8 +12,8 @@ void
 plicinit(void)
 {
   // set desired IRQ priorities non-zero (otherwise disabled).
-  *(uint32*)(PLIC + UART0_IRQ*4) = 1;
-  *(uint32*)(PLIC + VIRTIO0_IRQ*4) = 1;
+  *(uint32*)DEVVA(PLIC + UART0_IRQ*4) = 1;
+  *(uint32*)DEVVA(PLIC + VIRTIO0_IRQ*4) = 1;
 }
 
 void
@@ -23,10 +23,10 @@ plicinithart(void)
   
   // set enable bits for this hart's S-mode
   // for the uart and virtio disk.
-  *(uint32*)PLIC_SENABLE(hart) = (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ);
+  *(uint32*)DEVVA(PLIC_SENABLE(hart)) = (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ);
 
   // set this hart's S-mode priority threshold to 0.
-  *(uint32*)PLIC_SPRIORITY(hart) = 0;
+  *(uint32*)DEVVA(PLIC_SPRIORITY(hart)) = 0;
 }
 
 // ask the PLIC what interrupt we should serve.
@@ -34,7 +34,7 @@ int
 plic_claim(void)
 {
   int hart = cpuid();
-  int irq = *(uint32*)PLIC_SCLAIM(hart);
+  int irq = *(uint32*)DEVVA(PLIC_SCLAIM(hart));
   return irq;
 }
 
@@ -43,5 +43,5 @@ void
 plic_complete(int irq)
 {
   int hart = cpuid();
-  *(uint32*)PLIC_SCLAIM(hart) = irq;
+  *(uint32*)DEVVA(PLIC_SCLAIM(hart)) = irq;
 }
@@ -6,72 +6,28 @@
 #include "proc.h"
 #include "defs.h"
 
-#ifdef MLFQ
-struct proc *queue_top(struct Queue *q)
-{
-  if (q->head == q->tail)
-    return 0;
-  else
-  return q->procs[q->head];
-}
-
-void queue_push(struct Queue *q, struct proc *element)
-{
-  if (q->size == NPROC)
-    panic("Proccess limit exceeded");
-
-  q->procs[q->tail] = element;
-  q->tail++;
-  if (q->tail == NPROC)
-    q->tail = 0;
-  q->size++;
-}
-
-void queue_pop(struct Queue *q)
-{
-  if (q->size == 0)
-    panic("Empty queue");
-  q->head++;
-  if (q->head == NPROC)
-    q->head = 0;
-  q->size--;
-}
-
-void queue_remove(struct Queue *q, int pid)
-{
-  for (int curr = q->head; curr != q->tail; curr = (curr + 1) % (NPROC + 1))
-  {
-    if (q->procs[curr]->pid == pid)
-    {
-      struct proc *temp = q->procs[curr];
-      q->procs[curr] = q->procs[(curr + 1) % (NPROC + 1)];
-      q->procs[(curr + 1) % (NPROC + 1)] = temp;
-    }
-  }
-
-  q->tail--;
-  q->size--;
-  if (q->tail < 0)
-    q->tail = NPROC;
-}
-#endif
-
 struct cpu cpus[NCPU];
 
 struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Sleeping processes, hashed by wait channel, so that
+// wakeup(chan) only looks at processes that might be
+// sleeping on chan.
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;           // Linked through p->sqnext
+} sleepq[NSLEEPQ];
+
+#define SQHASH(chan) (((((uint64)(chan)) * 0x9E3779B97F4A7C15UL) >> 32) % NSLEEPQ)
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
 
-#ifdef MLFQ
-  struct Queue mlfq[NUMQ];
-#endif
-
 extern char trampoline[]; // trampoline.S
 
 // helps ensure that wakeups of wait()ing
@@ -105,19 +61,14 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
       p->kstack = KSTACK((int) (p - proc));
   }
-  #ifdef MLFQ
-    for(int i = 0 ; i < NUMQ ; i++)
-    {
-      mlfq[i].size  = 0;
-      mlfq[i].head = 0;
-      mlfq[i].tail  = 0;
-    }
-  #endif
+  runqinit();
 }
 
 // Must be called with interrupts disabled,
@@ -186,6 +137,9 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->rqcpu = 0;
+  p->asidgen = 0;
+  p->tlbstale = 0;
 
   p->is_on = 0;
   p->curr_ticks = 0;
@@ -213,6 +167,14 @@ found:
     return 0;
   }
 
+  // The kernel's page table, sharing the user memory.
+  p->kpagetable = kvmcreate(p->pagetable);
+  if(p->kpagetable == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -226,6 +188,7 @@ found:
 #ifdef PBS
   p->nschds = 0;
   p->statprior = 60;
+  p->heapidx = -1;
 #endif
 #ifdef LBS
   p->ntickets = 1;
@@ -237,7 +200,6 @@ found:
   {
     p->inqtime[i] = 0;
   }
-  p->inq = 0;
   p->runtime = 0;
 #endif
   return p;
@@ -258,12 +220,17 @@ freeproc(struct proc *p)
 
   p->alarm_trapfr_cpy=0;
   
+  if(p->kpagetable)
+    kfree((void*)p->kpagetable);
+  p->kpagetable = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  p->guard = 0;
   p->pid = 0;
   p->parent = 0;
+  p->vfork = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
@@ -282,7 +249,6 @@ freeproc(struct proc *p)
   {
     p->inqtime[i] = 0;
   }
-  p->inq = 0;
   p->runtime = 0;
 #endif
 }
@@ -370,6 +336,7 @@ userinit(void)
   p->cwd = namei("/");
 
   p->state = RUNNABLE;
+  runq_push(p);
 
   release(&p->lock);
 }
@@ -383,12 +350,25 @@ growproc(int n)
   struct proc *p = myproc();
 
   sz = p->sz;
+  // a vfork() child can't change the memory it borrows.
+  if(p->vfork)
+    return -1;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // the new pages are allocated when first touched, in
+    // page_fault_handler(), but don't promise more memory
+    // than there is.
+    if(n / PGSIZE > kfreepages() + swapfreepages() || sz + n > mmapbase(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
+    // a megapage that would be partly freed is split first.
+    if(PGROUNDUP(sz + n) % MEGASIZE != 0 &&
+       uvmdemote(p->pagetable, PGROUNDUP(sz + n)) < 0)
+      return -1;
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    tlb_flushall(p);
+    if(p->guard >= sz)
+      p->guard = 0;
   }
   p->sz = sz;
   return 0;
@@ -399,22 +379,35 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int i, pid, r;
   struct proc *np;
   struct proc *p = myproc();
 
+  // Pages of shared mappings must all exist to be shared,
+  // and the page tables copied need memory.
+  if(mmapprefault(p) < 0)
+    return -1;
+  swapensure();
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child. Even if that
+  // fails, some of our pages may be copy-on-write now.
+  r = uvmcopy(p->pagetable, np->pagetable, 0, p->sz, 0);
+  if(r == 0)
+    r = mmapfork(p, np);
+  tlb_flushall(p);
+  if(r < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
+  np->guard = p->guard;
+  np->rqcpu = p->rqcpu;
 
 #ifdef LBS
   np->ntickets = p->ntickets;
@@ -430,6 +423,81 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  np->execip = 0;
+  if(p->execip){
+    np->execip = idup(p->execip);
+    iexec(np->execip);
+  }
+  memmove(np->execseg, p->execseg, sizeof(p->execseg));
+  np->nexecseg = p->nexecseg;
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  runq_push(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Like fork(), but the child borrows the parent's memory instead
+// of getting a copy, and the parent waits until the child calls
+// exec() or exit(), so the cost doesn't depend on the parent's
+// size. Until then the child must not return from the function
+// that called vfork(), since it runs on the parent's stack.
+int
+vfork(void)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  // Share the parent's page tables.
+  if(uvmborrow(p->pagetable, np->pagetable, p->sz) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  kvmsync(np->kpagetable, np->pagetable);
+  np->sz = p->sz;
+  np->guard = p->guard;
+  np->rqcpu = p->rqcpu;
+
+#ifdef LBS
+  np->ntickets = p->ntickets;
+#endif
+  // copy saved user registers.
+  *(np->trapframe) = *(p->trapframe);
+  np->tracemask = p->tracemask;
+  // Cause vfork to return 0 in the child.
+  np->trapframe->a0 = 0;
+
+  // increment reference counts on open file descriptors.
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+  np->execip = 0;
+  if(p->execip){
+    np->execip = idup(p->execip);
+    iexec(np->execip);
+  }
+  memmove(np->execseg, p->execseg, sizeof(p->execseg));
+  np->nexecseg = p->nexecseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -439,15 +507,39 @@ fork(void)
 
   acquire(&wait_lock);
   np->parent = p;
+  np->vfork = 1;
+  p->lent = 1;
   release(&wait_lock);
 
   acquire(&np->lock);
   np->state = RUNNABLE;
+  runq_push(np);
   release(&np->lock);
 
+  // Wait for the child to give the memory back, even if killed:
+  // only then can the parent use or free it.
+  acquire(&wait_lock);
+  while(np->vfork)
+    sleep(np, &wait_lock);
+  p->lent = 0;
+  release(&wait_lock);
+
   return pid;
 }
 
+// p, a vfork() child, no longer uses its parent's memory:
+// let the parent go on.
+void
+vforkdone(struct proc *p)
+{
+  acquire(&wait_lock);
+  // p may have changed PTEs the parent has cached.
+  tlb_flushall(p->parent);
+  p->vfork = 0;
+  wakeup(p);
+  release(&wait_lock);
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -474,6 +566,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Write back and unmap mmap() memory while we still can.
+  mmapclear(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -483,10 +578,21 @@ exit(int status)
     }
   }
 
+  // Give a borrowed address space back to the parent.
+  if(p->vfork){
+    uvmunborrow(p->pagetable);
+    p->sz = 0;
+    vforkdone(p);
+  }
+
   begin_op();
   iput(p->cwd);
+  if(p->execip)
+    iexecput(p->execip);
   end_op();
   p->cwd = 0;
+  p->execip = 0;
+  p->nexecseg = 0;
 
   acquire(&wait_lock);
 
@@ -515,7 +621,7 @@ int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -532,12 +638,17 @@ wait(uint64 addr)
         if(pp->state == ZOMBIE){
           // Found one.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
+          xstate = pp->xstate;
+          release(&pp->lock);
+          release(&wait_lock);
+          // copy the status out with no locks held, since the
+          // copy may fault and sleep. pp stays a zombie: only
+          // its parent, this process, frees it.
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
             return -1;
-          }
+          acquire(&wait_lock);
+          acquire(&pp->lock);
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
@@ -558,271 +669,64 @@ wait(uint64 addr)
   }
 }
 
-// Per-CPU process  .
+// Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take the next process off this cpu's run queue
+//    (or steal one from another cpu, see runq.c).
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
-
-void preemptandaging()
-{
-  #ifdef MLFQ
-  struct proc *p = 0;
-        for(p = proc ; p < &proc[NPROC]; p++)
-      { 
-        acquire(&p->lock);
-        if(p->state == RUNNABLE && ticks - p->qctime >= AGING)
-        {
-          p->qctime = ticks;
-        if (p->inq)
-        {
-          queue_remove(&mlfq[p->qnum], p->pid);
-          p->inq = 0;
-        }
-        if (p->qnum)
-          p->qnum--;
-        }
-        release(&p->lock);
-      }
-
-      for (p = proc; p < &proc[NPROC]; p++)
-      {
-        acquire(&p->lock);
-        if (p->state == RUNNABLE && p->inq == 0)
-        {
-          queue_push(&mlfq[p->qnum], p);
-          p->inq = 1;
-        }
-        release(&p->lock);
-      }
-  #endif
-}
 void
 scheduler(void)
 {
-  struct proc *p = 0;
+  struct proc *p;
   struct cpu *c = mycpu();
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
-  #ifndef MLFQ
-    #ifdef FCFS
-     struct proc * firstcome = 0;
-    #endif
-
-    #ifdef PBS
-      struct proc * lowprior = 0;
-    #endif
-
-    #ifdef LBS
-      struct proc * chosen = 0;
-      int totaltickets = 0;
-      unsigned long random;
-      do_rand(&random);
-      int currtickets = 0;
-      struct proc * p2 = 0;
-      for(p2 = proc ; p2 < &proc[NPROC]; p2++)
-      {
-        acquire(&p2->lock);
-        if(p2->state == RUNNABLE)
-          totaltickets += p2->ntickets;
-        release(&p2->lock);
-      }
-      random = random % totaltickets + 1;
-    #endif
-
-    for(p = proc; p < &proc[NPROC]; p++) {
 
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        #ifdef RR
-
-          p->state = RUNNING;
-          c->proc = p;
-          swtch(&c->context, &p->context);
-          c->proc = 0;
-
-        #endif
-          
-        #ifdef FCFS
-          if(firstcome == 0)
-          {
-            firstcome = p;
-            continue;
-          }
-          else if(p->ctime < firstcome->ctime)
-          {
-            release(&firstcome->lock);
-            firstcome = p;
-            continue;
-          }
-        #endif
-
-        #ifdef PBS
-          if(lowprior == 0)
-          {
-            lowprior = p;
-            continue;
-          }
-          else
-          {
-            int cp = priority(p);
-            int lp = priority(lowprior);
-            if(cp < lp)
-            {
-              release(&lowprior->lock);
-              lowprior = p;
-              continue;
-            }
-            else if(cp == lp)
-            {
-              if(p->nschds < lowprior->nschds)
-              {
-                release(&lowprior->lock);
-                lowprior = p;
-                continue;
-              }
-              else if(p->nschds == lowprior->nschds)
-              {
-                if(p->ctime < lowprior->ctime)
-                {
-                  release(&lowprior->lock);
-                  lowprior = p;
-                  continue;
-                }
-              }
-            }
-          }
-        #endif
-
-        #ifdef LBS
-          
-          currtickets += p->ntickets;
-          if(currtickets >= random)
-          {
-            chosen =p;
-            break;
-          }
-        #endif
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-      }
-      release(&p->lock);
+    if((p = runq_pop()) == 0){
+      // nothing to run: zero a page for kzalloc(),
+      // or if there's no need, wait for work.
+      if(!kzero_fill())
+        runq_idle();
+      continue;
     }
-    #ifdef FCFS
-      if(firstcome != 0)
-      {
-        firstcome->state = RUNNING;
-        c->proc = firstcome;
-        swtch(&c->context, &firstcome->context);
-        c->proc = 0;
-        release(&firstcome->lock);
-      }
-    #endif 
-    #ifdef PBS
-      if(lowprior !=0)
-      {
-        lowprior->nschds++;
-        lowprior->rtime = 0;
-        lowprior->stime =0;
-        lowprior->state = RUNNING;
-        c->proc = lowprior;
-        swtch(&c->context, &lowprior->context);
-        c->proc = 0;
-        release(&lowprior->lock);
-      }
-    #endif
-    #ifdef LBS
-      if(chosen !=0)
-      {
-        chosen->state = RUNNING;
-        c->proc = chosen;
-        swtch(&c->context, &chosen->context);
-        c->proc = 0;
-        release(&chosen->lock);
-      }
-    #endif
-  #endif
-    #ifdef MLFQ
-
-      struct proc* lowprior = 0;
-      for(p = proc ; p < &proc[NPROC]; p++)
-      { 
-        if(p->state == RUNNABLE)
-        {
-          acquire(&p->lock);
-          if(p->state == RUNNABLE && ticks - p->qctime >= AGING)
-          {
-            p->qctime = ticks;
-          if (p->inq)
-          {
-            queue_remove(&mlfq[p->qnum], p->pid);
-            p->inq = 0;
-          }
-          if (p->qnum)
-            p->qnum--;
-          }
-          release(&p->lock);
-        }
-      }
-      // for(p = proc ; p < &proc[NPROC]; p++)
-      // {
-      //   if(p->pid >= 9 && p->pid <=13)
-      //   printf("%d,%d,%d\n", p->pid, p->qnum , ticks);
-      // }
-      for (p = proc; p < &proc[NPROC]; p++)
-      {
-        acquire(&p->lock);
-        if (p->state == RUNNABLE && p->inq == 0)
-        {
-          queue_push(&mlfq[p->qnum], p);
-          p->inq = 1;
-        }
-        release(&p->lock);
-      }
-
-      for (int i = 0; i < NUMQ; i++)
-      {
-
-        while (mlfq[i].size > 0)
-        {
-          p = queue_top(&mlfq[i]);
-          acquire(&p->lock);
-          queue_remove(&mlfq[i], p->pid);
-          p->inq = 0;
-          if (p->state == RUNNABLE)
-          {
-
-            p->qctime = ticks;
-            lowprior = p;
-            break;
-          }
-          release(&p->lock);
-        }
-        if (lowprior)
-          break;
-      }
-      if (lowprior)
-      {
-        lowprior->state = RUNNING;
-        c->proc = lowprior;
-        lowprior->runtime = 0;
 
-        swtch(&c->context, &lowprior->context);
-        c->proc = 0;
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
 
-        lowprior->qctime = ticks;
-        release(&lowprior->lock);
-      }
-    #endif
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+#ifdef PBS
+    p->nschds++;
+    p->rtime = 0;
+    p->stime = 0;
+#endif
+#ifdef MLFQ
+    p->runtime = 0;
+#endif
+    p->state = RUNNING;
+    p->rqcpu = cpuid();
+    c->proc = p;
+    kvmswitch(p);
+    swtch(&c->context, &p->context);
+    // before p can be freed.
+    kvmswitch(0);
+    c->proc = 0;
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back;
+    // a process that yield()ed goes back on a run queue only
+    // now that it is off this cpu's stack.
+    if(p->state == RUNNABLE)
+      runq_push(p);
+    release(&p->lock);
   }
 }
 
@@ -881,6 +785,7 @@ forkret(void)
     // be run from main().
     first = 0;
     fsinit(ROOTDEV);
+    swapinit();
   }
 
   usertrapret();
@@ -892,28 +797,44 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq = &sleepq[SQHASH(chan)];
+  struct proc **pp;
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // Once p is on chan's sleep queue and we
+  // hold p->lock, we can be guaranteed that
+  // we won't miss any wakeup (wakeup looks
+  // at the queue and then locks p->lock),
   // so it's okay to release lk.
 
+  acquire(&sq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
+  p->sqnext = sq->head;
+  sq->head = p;
+  release(&sq->lock);
   p->state = SLEEPING;
 
   sched();
 
-  // Tidy up.
-  p->chan = 0;
+  release(&p->lock);
+
+  // Tidy up. wakeup() takes us off the sleep queue,
+  // but kill() leaves that to us.
+  acquire(&sq->lock);
+  if(p->chan){
+    for(pp = &sq->head; *pp != p; pp = &(*pp)->sqnext)
+      ;
+    *pp = p->sqnext;
+    p->chan = 0;
+  }
+  release(&sq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -922,17 +843,26 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct sleepq *sq = &sleepq[SQHASH(chan)];
+  struct proc *p, **pp;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+  acquire(&sq->lock);
+  for(pp = &sq->head; (p = *pp) != 0; ){
+    if(p->chan == chan){
       acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
+      if(p->state == SLEEPING){
+        *pp = p->sqnext;
+        p->chan = 0;
         p->state = RUNNABLE;
+        runq_push(p);
+        release(&p->lock);
+        continue;
       }
       release(&p->lock);
     }
+    pp = &p->sqnext;
   }
+  release(&sq->lock);
 }
 
 // Kill the process with the given pid.
@@ -950,6 +880,7 @@ kill(int pid)
       if(p->state == SLEEPING){
         // Wake process from sleep().
         p->state = RUNNABLE;
+        runq_push(p);
       }
       release(&p->lock);
       return 0;
@@ -1048,13 +979,14 @@ procdump(void)
     #endif
     printf("\n");
   }
+  kmemdump();
 }
 
 int
 waitx(uint64 addr, uint* wtime, uint* rtime)
 {
   struct proc *np;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -1073,12 +1005,17 @@ waitx(uint64 addr, uint* wtime, uint* rtime)
           pid = np->pid;
           *rtime = np->rtime;
           *wtime = np->exit_time - np->ctime - np->rtime;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&wait_lock);
+          xstate = np->xstate;
+          release(&np->lock);
+          release(&wait_lock);
+          // copy the status out with no locks held, since the
+          // copy may fault and sleep. np stays a zombie: only
+          // its parent, this process, frees it.
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
             return -1;
-          }
+          acquire(&wait_lock);
+          acquire(&np->lock);
           freeproc(np);
           release(&np->lock);
           release(&wait_lock);
@@ -1185,6 +1122,11 @@ int setpriority(int priority, int pid)
         {
             p->rtime = 0;
             p->stime = 0;
+        }
+        if(p->state == RUNNABLE)
+          runq_requeue(p);
+        if(old < priority)
+        {
             flag = 0;
             release(&p->lock);
             yield();
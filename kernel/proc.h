@@ -1,12 +1,5 @@
 
 
-struct Queue{
-    int head;
-    int tail;
-    int size;
-    struct proc* procs[NPROC ]; 
-};
-
 // Saved registers for kernel context switches.
 struct context {
   uint64 ra;
@@ -27,12 +20,38 @@ struct context {
   uint64 s11;
 };
 
+// Per-CPU queue of RUNNABLE processes, see runq.c.
+struct runq {
+  struct spinlock lock;
+#if defined(PBS)
+  struct proc *heap[NPROC];   // Queued processes, as a min-heap.
+#elif defined(LBS)
+  int fen[NPROC+1];           // Fenwick tree of queued tickets, by proc slot.
+  int tickets[NPROC];         // Tickets each slot was queued with.
+  int total;                  // Sum of tickets[].
+#elif defined(MLFQ)
+  struct proc *head[NUMQ];    // One FIFO per level, linked through
+  struct proc *tail[NUMQ];    //   p->rqnext and p->rqprev.
+  int count[NUMQ];            // Number of processes on each level.
+#else
+  struct proc *head;          // Queued processes, linked through
+  struct proc *tail;          //   p->rqnext and p->rqprev.
+#endif
+  int nrun;                   // Number of queued processes.
+#ifdef LBS
+  unsigned long seed;         // Lottery random state.
+#endif
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct runq rq;             // Processes waiting to run on this cpu.
+  volatile int idle;          // Is this cpu waiting in wfi for work?
+  uint64 asidgen;             // ASID generation this cpu's TLB is flushed for
 };
 
 extern struct cpu cpus[NCPU];
@@ -96,13 +115,28 @@ struct proc {
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
-  void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int rqcpu;                   // Run queue p goes on when RUNNABLE
+
+  // the lock of chan's sleep queue must be held when using these:
+  void *chan;                  // If non-zero, sleeping on chan
+  struct proc *sqnext;         // Next process on the sleep queue
+
+  // the run queue's lock must be held when using these:
+#if defined(PBS)
+  int heapidx;                 // Index in run queue heap, or -1
+  int dprio;                   // Dynamic priority while queued
+#elif !defined(LBS)
+  struct proc *rqnext;         // Run queue links
+  struct proc *rqprev;
+#endif
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
+  int vfork;                   // Borrowing parent's memory; see vfork()
+  int lent;                    // Lending memory to a vfork() child
   //new
   int tracemask;
 
@@ -116,10 +150,29 @@ struct proc {
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel's, with user memory too; see kvmcreate()
+  uint64 guard;                // User stack guard page, never mapped
+  int asid;                    // Address space identifier; see asid.c
+  uint64 asidgen;              // Generation of asid, or 0 if none
+  uint tlbstale;               // Cpus that must flush asid (atomic)
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  int blkplug;                 // Disk requests held back; see blk_plug()
+  struct inode *execip;        // Program file, for execfault()
+  struct execseg {             // Program pages still to be paged in
+    uint64 va, end;
+    uint off;                  // File offset of va
+    int perm;
+  } execseg[NEXECSEG];
+  int nexecseg;
+  struct vma {                 // mmap() mappings; see mmap.c
+    uint64 start, end;         // Unused if start == end
+    int prot, flags;
+    struct file *f;            // 0 for anonymous memory
+    uint off;                  // File offset of start
+  } vma[NVMA];
   char name[16];               // Process name (debugging)
 
   int rtime;
@@ -137,10 +190,9 @@ struct proc {
 
 #ifdef MLFQ
   int qnum;
-  int qctime;
+  int qctime;                  // When p joined its current run queue level
   int inqtime[NUMQ];
-  
-  int inq;
+
   int runtime;
 
 #endif
@@ -148,9 +200,3 @@ struct proc {
 
 
 
-struct proc *queue_top(struct Queue *q);
-void queue_push(struct Queue *q, struct proc *element);
-void queue_pop(struct Queue *q);
-void queue_remove(struct Queue *q, int pid);
-
-
@@ -0,0 +1,451 @@
+// Per-CPU run queues.
+//
+// Every RUNNABLE process that is not on a cpu sits on exactly
+// one cpu's run queue, linked through p->rqnext and p->rqprev.
+// scheduler() takes its next process from its own queue, and only
+// looks at the other cpus' queues, stealing one process, when its
+// own queue is empty. Busy cpus therefore never touch each other's
+// locks, and no cpu takes the per-process locks to find work.
+//
+// PBS keeps each queue as a binary min-heap instead of a list,
+// so its pick is O(1) and queueing is O(log n). LBS keeps a
+// Fenwick tree of the queued processes' tickets, so a draw
+// costs O(log NPROC). MLFQ keeps one FIFO list per level.
+//
+// A cpu with nothing to run waits in wfi, with its timer off,
+// until runq_push() sends it an IPI.
+//
+// Lock order: p->lock, then rq->lock. Never acquire a p->lock
+// while holding a rq->lock. While p is queued, rq->lock protects
+// its links and the scheduling fields the policy looks at.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+extern struct proc proc[NPROC];
+
+void
+runqinit(void)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    initlock(&c->rq.lock, "runq");
+#if defined(LBS)
+    memset(c->rq.fen, 0, sizeof(c->rq.fen));
+    memset(c->rq.tickets, 0, sizeof(c->rq.tickets));
+    c->rq.total = 0;
+    c->rq.seed = (c - cpus) + 1;
+#elif defined(MLFQ)
+    for(int i = 0; i < NUMQ; i++){
+      c->rq.head[i] = 0;
+      c->rq.tail[i] = 0;
+      c->rq.count[i] = 0;
+    }
+#elif !defined(PBS)
+    c->rq.head = 0;
+    c->rq.tail = 0;
+#endif
+    c->rq.nrun = 0;
+  }
+}
+
+#ifdef PBS
+// Does a run ahead of b? Lowest dynamic priority first, then
+// fewest schedules, then oldest, then proc table order.
+static int
+pbs_before(struct proc *a, struct proc *b)
+{
+  if(a->dprio != b->dprio)
+    return a->dprio < b->dprio;
+  if(a->nschds != b->nschds)
+    return a->nschds < b->nschds;
+  if(a->ctime != b->ctime)
+    return a->ctime < b->ctime;
+  return a < b;
+}
+
+static void
+heap_set(struct runq *rq, int i, struct proc *p)
+{
+  rq->heap[i] = p;
+  p->heapidx = i;
+}
+
+// Move the process at heap index i up or down
+// until the heap is ordered again.
+static void
+heap_fix(struct runq *rq, int i)
+{
+  struct proc *p = rq->heap[i];
+  int c;
+
+  while(i > 0 && pbs_before(p, rq->heap[(i - 1) / 2])){
+    heap_set(rq, i, rq->heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  while((c = 2*i + 1) < rq->nrun){
+    if(c + 1 < rq->nrun && pbs_before(rq->heap[c + 1], rq->heap[c]))
+      c++;
+    if(!pbs_before(rq->heap[c], p))
+      break;
+    heap_set(rq, i, rq->heap[c]);
+    i = c;
+  }
+  heap_set(rq, i, p);
+}
+
+static void
+rq_insert(struct runq *rq, struct proc *p)
+{
+  // p's dynamic priority can't change while it waits:
+  // update_time() only charges RUNNING and SLEEPING
+  // processes, and setpriority() requeues.
+  p->dprio = priority(p);
+  heap_set(rq, rq->nrun++, p);
+  heap_fix(rq, rq->nrun - 1);
+}
+
+static void
+rq_unlink(struct runq *rq, struct proc *p)
+{
+  int i = p->heapidx;
+
+  p->heapidx = -1;
+  if(i != --rq->nrun){
+    heap_set(rq, i, rq->heap[rq->nrun]);
+    heap_fix(rq, i);
+  }
+}
+
+#elif defined(LBS)
+// Add delta tickets to proc table slot i.
+static void
+fen_add(struct runq *rq, int i, int delta)
+{
+  for(i++; i <= NPROC; i += i & -i)
+    rq->fen[i] += delta;
+}
+
+static void
+rq_insert(struct runq *rq, struct proc *p)
+{
+  int i = p - proc;
+
+  rq->tickets[i] = p->ntickets;
+  rq->total += p->ntickets;
+  fen_add(rq, i, p->ntickets);
+  rq->nrun++;
+}
+
+static void
+rq_unlink(struct runq *rq, struct proc *p)
+{
+  int i = p - proc;
+
+  fen_add(rq, i, -rq->tickets[i]);
+  rq->total -= rq->tickets[i];
+  rq->tickets[i] = 0;
+  rq->nrun--;
+}
+
+#else
+// Link p into the list head/tail in front of next,
+// or at the tail if next is 0.
+static void
+list_insert(struct proc **head, struct proc **tail, struct proc *p, struct proc *next)
+{
+  p->rqnext = next;
+  if(next){
+    p->rqprev = next->rqprev;
+    next->rqprev = p;
+  } else {
+    p->rqprev = *tail;
+    *tail = p;
+  }
+  if(p->rqprev)
+    p->rqprev->rqnext = p;
+  else
+    *head = p;
+}
+
+static void
+list_unlink(struct proc **head, struct proc **tail, struct proc *p)
+{
+  if(p->rqprev)
+    p->rqprev->rqnext = p->rqnext;
+  else
+    *head = p->rqnext;
+  if(p->rqnext)
+    p->rqnext->rqprev = p->rqprev;
+  else
+    *tail = p->rqprev;
+  p->rqnext = 0;
+  p->rqprev = 0;
+}
+
+#ifdef MLFQ
+// p goes to the tail of its level's list. Each list is therefore
+// in qctime order, and runq_age() only has to look at the heads.
+static void
+rq_insert(struct runq *rq, struct proc *p)
+{
+  p->qctime = ticks;
+  list_insert(&rq->head[p->qnum], &rq->tail[p->qnum], p, 0);
+  rq->count[p->qnum]++;
+  rq->nrun++;
+}
+
+static void
+rq_unlink(struct runq *rq, struct proc *p)
+{
+  list_unlink(&rq->head[p->qnum], &rq->tail[p->qnum], p);
+  rq->count[p->qnum]--;
+  rq->nrun--;
+}
+
+#else
+// Link p into rq, at the tail or, for FCFS, in ctime order.
+static void
+rq_insert(struct runq *rq, struct proc *p)
+{
+  struct proc *next = 0;
+
+#ifdef FCFS
+  for(next = rq->head; next && next->ctime <= p->ctime; next = next->rqnext)
+    ;
+#endif
+  list_insert(&rq->head, &rq->tail, p, next);
+  rq->nrun++;
+}
+
+static void
+rq_unlink(struct runq *rq, struct proc *p)
+{
+  list_unlink(&rq->head, &rq->tail, p);
+  rq->nrun--;
+}
+#endif
+#endif
+
+// Pick the process rq should run next under the compiled-in
+// policy. rq->lock must be held and rq must not be empty.
+static struct proc*
+rq_choose(struct runq *rq)
+{
+#if defined(PBS)
+  return rq->heap[0];
+#elif defined(LBS)
+  // draw a ticket, and find the first slot whose running
+  // total of tickets passes it, the same answer as walking
+  // the proc table in order.
+  int draw, top, i = 0;
+
+  do_rand(&rq->seed);
+  draw = rq->seed % rq->total;
+  for(top = 1; top * 2 <= NPROC; top *= 2)
+    ;
+  for(int step = top; step > 0; step >>= 1){
+    if(i + step <= NPROC && rq->fen[i + step] <= draw){
+      i += step;
+      draw -= rq->fen[i];
+    }
+  }
+  return &proc[i];
+#elif defined(MLFQ)
+  // the longest queued process of the highest level.
+  int i;
+
+  for(i = 0; rq->count[i] == 0; i++)
+    ;
+  return rq->head[i];
+#else
+  // RR runs the queue in order; FCFS keeps it sorted by ctime.
+  return rq->head;
+#endif
+}
+
+// Wake an idle cpu to run a process just queued on cpu target:
+// target itself if it is idle, else any idle cpu, which will
+// steal it. Caller must have interrupts off.
+static void
+rq_kick(int target)
+{
+  struct cpu *me = mycpu();
+  struct cpu *c;
+
+  // pairs with the fence in runq_idle(): either that cpu sees
+  // the process we just queued, or we see that it is idle.
+  __sync_synchronize();
+
+  c = &cpus[target];
+  if(c != me && c->idle){
+    sendipi(target);
+    return;
+  }
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c != me && c->idle){
+      sendipi(c - cpus);
+      return;
+    }
+  }
+}
+
+// Put p, which has just become RUNNABLE, on the run queue
+// of the cpu it last ran on. Caller must hold p->lock.
+void
+runq_push(struct proc *p)
+{
+  struct runq *rq = &cpus[p->rqcpu].rq;
+
+  if(!holding(&p->lock))
+    panic("runq_push");
+
+  acquire(&rq->lock);
+  rq_insert(rq, p);
+  release(&rq->lock);
+
+  rq_kick(p->rqcpu);
+}
+
+// Remove and return the process rq should run next,
+// or 0 if rq is empty.
+static struct proc*
+rq_take(struct runq *rq)
+{
+  struct proc *p = 0;
+
+  // peek without the lock so that idle cpus looking for
+  // work don't bounce the lock of an empty queue around.
+  if(*(volatile int*)&rq->nrun == 0)
+    return 0;
+
+  acquire(&rq->lock);
+  if(rq->nrun > 0){
+    p = rq_choose(rq);
+    rq_unlink(rq, p);
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Return the next process this cpu should run, removed from
+// its run queue, or 0 if there is nothing to run. If this cpu's
+// queue is empty, steal from the other cpus.
+// Called from scheduler(), which never changes cpus.
+struct proc*
+runq_pop(void)
+{
+  int id = cpuid();
+  struct proc *p;
+
+  if((p = rq_take(&cpus[id].rq)) != 0)
+    return p;
+  for(int i = 1; i < NCPU; i++){
+    if((p = rq_take(&cpus[(id + i) % NCPU].rq)) != 0)
+      return p;
+  }
+  return 0;
+}
+
+// There is nothing to run: stall this cpu in wfi until an
+// interrupt, usually an IPI from rq_kick(), says there may be.
+// Harts other than 0, which keeps ticks, stop their timer
+// interrupts while they wait.
+void
+runq_idle(void)
+{
+  struct cpu *c;
+  int id;
+
+  intr_off();
+  id = cpuid();
+  mycpu()->idle = 1;
+
+  // look once more now that rq_kick() can see we are idle.
+  __sync_synchronize();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(*(volatile int*)&c->rq.nrun > 0){
+      mycpu()->idle = 0;
+      return;
+    }
+  }
+
+  if(id != 0)
+    timeroff();
+  wfi();
+  mycpu()->idle = 0;
+  if(id != 0)
+    timeron();
+
+  // the scheduler loop turns interrupts back on, and takes
+  // whatever interrupt woke us.
+}
+
+#ifdef PBS
+// p's static priority has changed. If p is waiting on a run
+// queue, move it to its new place. Caller must hold p->lock.
+void
+runq_requeue(struct proc *p)
+{
+  struct runq *rq = &cpus[p->rqcpu].rq;
+
+  acquire(&rq->lock);
+  if(p->heapidx >= 0){
+    rq_unlink(rq, p);
+    rq_insert(rq, p);
+  }
+  release(&rq->lock);
+}
+#endif
+
+#ifdef MLFQ
+// Move processes that have been waiting for AGING ticks on
+// this cpu's run queue up one MLFQ level. Only the head of
+// each level can be due, and an aged process joins the tail
+// of the level above with a fresh qctime, which keeps that
+// list in qctime order too.
+void
+runq_age(void)
+{
+  struct runq *rq;
+  struct proc *p;
+
+  push_off();
+  rq = &mycpu()->rq;
+  if(rq->nrun > 0){
+    acquire(&rq->lock);
+    for(int i = 1; i < NUMQ; i++){
+      while((p = rq->head[i]) != 0 && ticks - p->qctime >= AGING){
+        rq_unlink(rq, p);
+        p->qnum--;
+        rq_insert(rq, p);
+      }
+    }
+    release(&rq->lock);
+  }
+  pop_off();
+}
+
+// Is a process above MLFQ level `level` waiting on
+// this cpu's run queue?
+int
+runq_waiting(int level)
+{
+  struct runq *rq;
+  int found = 0;
+
+  push_off();
+  rq = &mycpu()->rq;
+  for(int i = 0; i < level; i++)
+    if(rq->count[i])
+      found = 1;
+  pop_off();
+  return found;
+}
+#endif
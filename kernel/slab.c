@@ -0,0 +1,306 @@
+// Slab allocator, for kernel objects smaller than a page.
+//
+// Each object cache, made by slab_create(), hands out objects of
+// one size, carved out of pages from kalloc(). A page, or slab,
+// starts with a struct slab and holds as many objects as fit
+// after it; the free ones are linked through their first word.
+// The cache keeps its slabs on three lists, full, partial and
+// empty, and allocates from partial slabs first so that empty
+// ones can go back to kalloc(). It keeps one empty slab, so that
+// a cache that shrinks and grows again doesn't keep freeing and
+// allocating the same page.
+//
+// Each cpu has a magazine of free objects in front of each cache,
+// so slab_alloc() and slab_free() normally take only that cpu's
+// uncontended lock. A magazine that runs dry takes half of its
+// size from the slabs, and one that fills up gives half back.
+//
+// Lock order: a magazine's lock, then the cache's lock, then
+// kalloc()'s. Never hold two magazine locks.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "kstats.h"
+#include "defs.h"
+
+#define MAGSIZE  16   // most free objects a magazine holds
+#define SLABKEEP 1    // empty slabs a cache keeps
+
+struct slab {
+  struct slab *next;
+  struct slab *prev;
+  struct slabcache *cache;
+  void *free;          // free objects, linked through their first word
+  int inuse;           // objects allocated, including those in magazines
+};
+
+#define SLABHDR ((sizeof(struct slab) + 7) & ~7)
+
+struct magazine {
+  struct spinlock lock;
+  int n;
+  void *obj[MAGSIZE];
+  uint64 allocs;
+  uint64 frees;
+  uint64 misses;       // refills and flushes
+};
+
+struct slabcache {
+  struct spinlock lock;
+  char *name;          // 0 if the cache is unused
+  uint size;           // object size, rounded up to 8 bytes
+  uint perslab;        // objects per slab
+  struct slab *full;
+  struct slab *partial;
+  struct slab *empty;
+  int nslabs;
+  int nempty;
+  int inuse;           // objects out of the slabs
+  struct magazine mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct slabcache cache[NSLAB];
+} slabs;
+
+void
+slabinit(void)
+{
+  initlock(&slabs.lock, "slabs");
+}
+
+// Make a cache of objects of size bytes. name is kept, and shown
+// by slabinfo(). Panics if there is no room for another cache.
+struct slabcache*
+slab_create(char *name, uint size)
+{
+  struct slabcache *c;
+
+  size = (size + 7) & ~7;
+  if(size == 0 || size > PGSIZE - SLABHDR)
+    panic("slab_create: size");
+
+  acquire(&slabs.lock);
+  for(c = slabs.cache; c < &slabs.cache[NSLAB]; c++)
+    if(c->name == 0)
+      break;
+  if(c == &slabs.cache[NSLAB])
+    panic("slab_create: too many caches");
+  c->name = name;
+  release(&slabs.lock);
+
+  initlock(&c->lock, "slabcache");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&c->mag[i].lock, "magazine");
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  return c;
+}
+
+// The list s belongs on, by how many of its objects are in use.
+static struct slab**
+slab_list(struct slabcache *c, struct slab *s)
+{
+  if(s->inuse == 0)
+    return &c->empty;
+  if(s->inuse == c->perslab)
+    return &c->full;
+  return &c->partial;
+}
+
+static void
+slab_link(struct slab **list, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *list;
+  if(s->next)
+    s->next->prev = s;
+  *list = s;
+}
+
+static void
+slab_unlink(struct slab **list, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Make a new, empty slab. Caller holds c->lock.
+static struct slab*
+slab_grow(struct slabcache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  for(int i = c->perslab - 1; i >= 0; i--){
+    obj = (char*)s + SLABHDR + i * c->size;
+    *(void**)obj = s->free;
+    s->free = obj;
+  }
+  slab_link(&c->empty, s);
+  c->nslabs++;
+  c->nempty++;
+  return s;
+}
+
+// Take up to n objects from c's slabs into obj[].
+// Caller holds c->lock. Returns how many it took.
+static int
+slab_take(struct slabcache *c, void **obj, int n)
+{
+  struct slab *s;
+  int i;
+
+  for(i = 0; i < n; i++){
+    if((s = c->partial) == 0 && (s = c->empty) == 0 && (s = slab_grow(c)) == 0)
+      break;
+    slab_unlink(slab_list(c, s), s);
+    if(s->inuse == 0)
+      c->nempty--;
+    obj[i] = s->free;
+    s->free = *(void**)s->free;
+    s->inuse++;
+    slab_link(slab_list(c, s), s);
+  }
+  c->inuse += i;
+  return i;
+}
+
+// Put n objects from obj[] back in their slabs, and give
+// empty slabs past SLABKEEP back to kalloc(). Caller holds
+// c->lock.
+static void
+slab_put(struct slabcache *c, void **obj, int n)
+{
+  struct slab *s;
+
+  for(int i = 0; i < n; i++){
+    s = (struct slab*)PGROUNDDOWN((uint64)obj[i]);
+    if(s->cache != c)
+      panic("slab_free: wrong cache");
+    slab_unlink(slab_list(c, s), s);
+    *(void**)obj[i] = s->free;
+    s->free = obj[i];
+    s->inuse--;
+    if(s->inuse == 0 && c->nempty >= SLABKEEP){
+      c->nslabs--;
+      kfree((void*)s);
+      continue;
+    }
+    if(s->inuse == 0)
+      c->nempty++;
+    slab_link(slab_list(c, s), s);
+  }
+  c->inuse -= n;
+}
+
+// Allocate an object from c. Returns 0 if out of memory.
+// The object is not zeroed.
+void*
+slab_alloc(struct slabcache *c)
+{
+  struct magazine *m;
+  void *obj = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == 0){
+    acquire(&c->lock);
+    m->n = slab_take(c, m->obj, MAGSIZE / 2);
+    release(&c->lock);
+    m->misses++;
+  }
+  if(m->n > 0){
+    obj = m->obj[--m->n];
+    m->allocs++;
+  }
+  release(&m->lock);
+  pop_off();
+
+#ifdef POISON
+  if(obj)
+    memset(obj, 5, c->size); // fill with junk
+#endif
+  return obj;
+}
+
+// Free obj, which came from slab_alloc(c).
+void
+slab_free(struct slabcache *c, void *obj)
+{
+  struct magazine *m;
+  uint64 off = (uint64)obj % PGSIZE;
+
+  if((uint64)obj < KERNBASE || (uint64)obj >= PHYSTOP ||
+     off < SLABHDR || (off - SLABHDR) % c->size != 0)
+    panic("slab_free");
+#ifdef POISON
+  memset(obj, 1, c->size);
+#endif
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    slab_put(c, &m->obj[MAGSIZE / 2], MAGSIZE / 2);
+    release(&c->lock);
+    m->n = MAGSIZE / 2;
+    m->misses++;
+  }
+  m->obj[m->n++] = obj;
+  m->frees++;
+  release(&m->lock);
+  pop_off();
+}
+
+// Copy the usage of up to n caches to si[].
+// Returns how many it copied.
+int
+slabstats(struct slabinfo *si, int n)
+{
+  struct slabcache *c;
+  struct magazine *m;
+  int nc = 0;
+
+  for(c = slabs.cache; c < &slabs.cache[NSLAB] && nc < n; c++){
+    if(c->name == 0)
+      continue;
+    memset(si, 0, sizeof(*si));
+    safestrcpy(si->name, c->name, sizeof(si->name));
+    si->size = c->size;
+    si->perslab = c->perslab;
+    for(m = c->mag; m < &c->mag[NCPU]; m++){
+      acquire(&m->lock);
+      si->cached += m->n;
+      si->allocs += m->allocs;
+      si->frees += m->frees;
+      si->misses += m->misses;
+      release(&m->lock);
+    }
+    acquire(&c->lock);
+    si->slabs = c->nslabs;
+    si->inuse = c->inuse;
+    release(&c->lock);
+    // the counts were taken one after another, and may
+    // disagree a little while objects move around.
+    si->inuse = si->inuse > si->cached ? si->inuse - si->cached : 0;
+    si++;
+    nc++;
+  }
+  return nc;
+}
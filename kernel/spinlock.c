@@ -14,6 +14,7 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->nspin = 0;
 }
 
 // Acquire the lock.
@@ -29,8 +30,11 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  if(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    __sync_fetch_and_add(&lk->nspin, 1);
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      ;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -0,0 +1,313 @@
+// Swapping user pages to disk.
+//
+// The disk blocks past the end of the file system, which the
+// Makefile appends to fs.img, hold swap: one slot per page.
+// When free memory runs low, swapensure() evicts cold user
+// pages there, and page_fault_handler() reads them back when
+// they are touched again. An evicted page's PTE keeps its flags,
+// without PTE_V and with PTE_SWAP, and holds the slot number in
+// place of the physical page number.
+//
+// Victims are found by a clock hand that sweeps the processes'
+// page tables, giving pages the hardware has marked accessed a
+// second chance. Only pages that nothing but the one PTE refers
+// to, by their reference count, are evicted: a page shared by
+// copy-on-write, or held by the page cache, would need every
+// PTE that maps it changed. fork() shares a swapped-out page
+// by sharing its slot, which counts its PTEs; each process reads
+// its own copy back. Pages of MAP_SHARED mappings stay put too.
+// A megapage is split into pages before any of it is evicted.
+//
+// Eviction only touches processes that can't be running, under
+// their p->lock, and the process doing it, and leaves alone page
+// tables lent to or borrowed by vfork().
+//
+// Swap I/O is done a page at a time, one request after another.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "buf.h"
+#include "file.h"
+#include "fcntl.h"
+#include "kstats.h"
+#include "proc.h"
+#include "defs.h"
+
+#define SLOTBLOCKS (PGSIZE / BSIZE)
+
+extern struct proc proc[NPROC];
+extern struct superblock sb;
+
+struct {
+  struct spinlock lock;
+  uint start;              // first block of swap
+  uint nslots;             // pages of swap
+  ushort ref[NSWAP];       // PTEs that refer to each slot
+  char busy[NSWAP];        // being written out
+  uint nfree;              // slots with no refs that aren't busy
+  uint next;               // where to look for a free slot
+
+  struct sleeplock reclaim; // one evictor at a time, which
+  int hand;                 // owns the clock hand: a process
+  uint64 handva;            // and a user address in it
+
+  struct sleeplock io;     // swap I/O, one page at a time
+  struct buf iobuf;        // for virtio_disk_rwpage() to wait on
+} swap;
+
+// Called from forkret(), once the file system's size is known.
+void
+swapinit(void)
+{
+  uint blocks = virtio_disk_size();
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.reclaim, "swapreclaim");
+  initsleeplock(&swap.io, "swapio");
+  swap.start = sb.size;
+  if(blocks > swap.start)
+    swap.nslots = (blocks - swap.start) / SLOTBLOCKS;
+  if(swap.nslots > NSWAP)
+    swap.nslots = NSWAP;
+  swap.nfree = swap.nslots;
+  kstats.swappages = swap.nslots;
+}
+
+// Free slots, for sbrk() to count as memory it can promise.
+int
+swapfreepages(void)
+{
+  return *(volatile uint*)&swap.nfree;
+}
+
+// Take a free slot, busy and with one reference, or return -1.
+static int
+slotalloc(void)
+{
+  uint i, slot;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslots && swap.nfree > 0; i++){
+    slot = (swap.next + i) % swap.nslots;
+    if(swap.ref[slot] == 0 && !swap.busy[slot]){
+      swap.ref[slot] = 1;
+      swap.busy[slot] = 1;
+      swap.nfree--;
+      swap.next = slot + 1;
+      release(&swap.lock);
+      return slot;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+static void
+slotdone(uint slot)
+{
+  acquire(&swap.lock);
+  swap.busy[slot] = 0;
+  if(swap.ref[slot] == 0)
+    swap.nfree++;
+  wakeup(&swap.busy[slot]);
+  release(&swap.lock);
+}
+
+// Another PTE refers to slot, for uvmcopy().
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// A PTE no longer refers to slot.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0 && !swap.busy[slot])
+    swap.nfree++;
+  release(&swap.lock);
+}
+
+static void
+swapio(char *pa, uint slot, int write)
+{
+  acquiresleep(&swap.io);
+  virtio_disk_rwpage(&swap.iobuf, pa, swap.start + slot * SLOTBLOCKS, write);
+  releasesleep(&swap.io);
+}
+
+// May the page at va, mapped by pte, of p be evicted?
+static int
+evictable(struct proc *p, uint64 va, pte_t pte)
+{
+  struct vma *v;
+  void *pa;
+
+  if((pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U))
+    return 0;
+  pa = (void*)PTE2PA(pte);
+  if(pa == zeropage || get_pagereference(pa) != 1)
+    return 0;
+  if((v = mmapfind(p, va)) != 0 && (v->flags & MAP_SHARED))
+    return 0;
+  return 1;
+}
+
+// Look through p's memory from *va on for a page to evict, and
+// give it slot. Caller holds p->lock. Returns the page, with a
+// reference that was its PTE's, or 0 once past p's memory.
+static char*
+swapscan(struct proc *p, uint64 *va, uint slot)
+{
+  uint64 a;
+  pte_t *pte;
+  char *pa;
+
+  for(a = *va; a < MAXUVA; a += PGSIZE){
+    // a megapage is split, if its pages can be evicted at all.
+    if(((pte = megapte(p->pagetable, a)) != 0 &&
+        (get_pagereference((void*)PTE2PA(*pte)) != 1 || uvmdemote(p->pagetable, a) < 0)) ||
+       (pte = walk(p->pagetable, a, 0)) == 0){
+      // or there is nothing at all in this 2MB.
+      a = MEGAROUNDDOWN(a) + MEGASIZE - PGSIZE;
+      continue;
+    }
+    __sync_fetch_and_add(&kstats.swapscans, 1);
+    if(!evictable(p, a, *pte))
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    pa = (char*)PTE2PA(*pte);
+    *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~PTE_V) | PTE_SWAP;
+    tlb_flushall(p);
+    *va = a + PGSIZE;
+    return pa;
+  }
+  return 0;
+}
+
+// Find a page to evict to slot with the clock hand, and
+// unmap it. Returns the page, or 0 if there is none.
+static char*
+swapvictim(uint slot)
+{
+  struct proc *p;
+  char *pa;
+
+  // two sweeps, since the first may only clear accessed bits.
+  for(int i = 0; i <= 2*NPROC; i++){
+    p = &proc[swap.hand];
+    acquire(&p->lock);
+    if((p->state == SLEEPING || p->state == RUNNABLE || p == myproc()) &&
+       p->pagetable && !p->vfork && !p->lent &&
+       (pa = swapscan(p, &swap.handva, slot)) != 0){
+      release(&p->lock);
+      return pa;
+    }
+    release(&p->lock);
+    swap.hand = (swap.hand + 1) % NPROC;
+    swap.handva = 0;
+  }
+  return 0;
+}
+
+// Evict up to n pages. Returns how many were.
+static int
+swapreclaim(int n)
+{
+  int slot, done;
+  char *pa;
+
+  acquiresleep(&swap.reclaim);
+  for(done = 0; done < n; done++){
+    if((slot = slotalloc()) < 0)
+      break;
+    if((pa = swapvictim(slot)) == 0){
+      swapfree(slot);
+      slotdone(slot);
+      break;
+    }
+    swapio(pa, slot, 1);
+    slotdone(slot);
+    kfree(pa);
+    __sync_fetch_and_add(&kstats.swapouts, 1);
+  }
+  releasesleep(&swap.reclaim);
+  return done;
+}
+
+// Make sure there is some free memory, if it takes shrinking
+// the buffer cache or evicting pages, so that allocations that
+// can't wait for the disk, such as of page-table pages, succeed.
+// A no-op for callers holding spinlocks, which can't sleep.
+void
+swapensure(void)
+{
+  int noff;
+
+  if(kfreepages() >= SWAPLOW)
+    return;
+  push_off();
+  noff = mycpu()->noff;
+  pop_off();
+  if(noff > 1)
+    return;
+  // unused buffer cache pages cost no I/O to take back.
+  bshrink(SWAPBATCH);
+  if(swap.nslots == 0 || kfreepages() >= SWAPLOW)
+    return;
+  if(swapreclaim(SWAPBATCH) == 0)
+    __sync_fetch_and_add(&kstats.swapfails, 1);
+}
+
+// Read the page whose PTE, pte, says it is in swap back in.
+// Returns 0, or -1 if out of memory.
+int
+swapin(pte_t *pte)
+{
+  pte_t old = *pte;
+  uint slot = PTE2SLOT(old);
+  char *mem;
+  int noff;
+
+  // reading the page in sleeps, which a spinlock holder
+  // can't; nothing copies user memory holding one.
+  push_off();
+  noff = mycpu()->noff;
+  pop_off();
+  if(noff > 1)
+    return -1;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+
+  // wait for the page to be written out, if it is still being.
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.lock);
+  release(&swap.lock);
+
+  swapio(mem, slot, 0);
+  if(*pte != old){
+    // someone else swapped it in while we slept.
+    kfree(mem);
+    return 0;
+  }
+  *pte = PA2PTE(mem) | (PTE_FLAGS(old) & ~PTE_SWAP) | PTE_V;
+  swapfree(slot);
+  __sync_fetch_and_add(&kstats.swapins, 1);
+  return 0;
+}
@@ -108,6 +108,11 @@ extern uint64 sys_sigalarm(void);
 extern uint64 sys_setpriority(void);
 extern uint64 sys_settickets(void);
 extern uint64 sys_waitx(void);
+extern uint64 sys_kstats(void);
+extern uint64 sys_vfork(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_slabinfo(void);
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
 static uint64 (*syscalls[])(void) = {
@@ -138,6 +143,11 @@ static uint64 (*syscalls[])(void) = {
 [SYS_setpriority] sys_setpriority,
 [SYS_settickets] sys_settickets,
 [SYS_waitx] sys_waitx,
+[SYS_kstats] sys_kstats,
+[SYS_vfork] sys_vfork,
+[SYS_mmap] sys_mmap,
+[SYS_munmap] sys_munmap,
+[SYS_slabinfo] sys_slabinfo,
 };
 
 char *syscallnames[] = {
@@ -166,7 +176,13 @@ char *syscallnames[] = {
     [SYS_sigreturn] "sigreturn",
     [SYS_sigalarm] "sigalarm",
     [SYS_setpriority] "setpriority",
-    [SYS_settickets] "settickets"
+    [SYS_settickets] "settickets",
+    [SYS_waitx] "waitx",
+    [SYS_kstats] "kstats",
+    [SYS_vfork] "vfork",
+    [SYS_mmap] "mmap",
+    [SYS_munmap] "munmap",
+    [SYS_slabinfo] "slabinfo"
 };
 
 int sig_argument_count[] = {
@@ -195,7 +211,13 @@ int sig_argument_count[] = {
     [SYS_sigreturn] 0,
     [SYS_sigalarm] 2,
     [SYS_setpriority] 2,
-    [SYS_settickets] 1
+    [SYS_settickets] 1,
+    [SYS_waitx] 3,
+    [SYS_kstats] 1,
+    [SYS_vfork] 0,
+    [SYS_mmap] 6,
+    [SYS_munmap] 2,
+    [SYS_slabinfo] 2
 };
 
 void syscall(void)
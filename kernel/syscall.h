@@ -26,4 +26,9 @@
 #define SYS_sigalarm 24
 #define SYS_setpriority 25
 #define SYS_settickets 26
-#define SYS_waitx 27
\ No newline at end of file
+#define SYS_waitx 27
+#define SYS_kstats 28
+#define SYS_vfork 29
+#define SYS_mmap 30
+#define SYS_munmap 31
+#define SYS_slabinfo 32
@@ -5,6 +5,8 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "timer.h"
+#include "kstats.h"
 
 
 void restore(){
@@ -40,6 +42,12 @@ sys_fork(void)
   return fork();
 }
 
+uint64
+sys_vfork(void)
+{
+  return vfork();
+}
+
 uint64
 sys_wait(void)
 {
@@ -66,17 +74,25 @@ sys_sleep(void)
 {
   int n;
   uint ticks0;
+  struct timer t;
 
   argint(0, &n);
   acquire(&tickslock);
   ticks0 = ticks;
+  t.pending = 0;
   while(ticks - ticks0 < n){
     if(killed(myproc())){
+      timer_del(&t);
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    // only the timer, run by clockintr() with tickslock
+    // held, wakes us, so it can't be missed.
+    if(!t.pending)
+      timer_add(&t, ticks0 + n, timer_wakeup, &t);
+    sleep(&t, &tickslock);
   }
+  timer_del(&t);
   release(&tickslock);
   return 0;
 }
@@ -199,4 +215,43 @@ sys_waitx(void)
     return -1;
 
   return ret;
-}
\ No newline at end of file
+}
+
+// copy the kernel's event counters to user address addr.
+uint64
+sys_kstats(void)
+{
+  uint64 addr;
+  struct kstats ks;
+
+  argaddr(0, &addr);
+  ks = kstats;
+  ks.freepages = kfreepages();
+  ks.swapfree = swapfreepages();
+  ks.bcachespins = bspins();
+  ks.bcachepages = bpages();
+  if(copyout(myproc()->pagetable, addr, (char*)&ks, sizeof(ks)) < 0)
+    return -1;
+  return 0;
+}
+
+// Copy the usage of up to n slab caches to the user's array.
+// Returns how many were copied.
+uint64
+sys_slabinfo(void)
+{
+  uint64 addr;
+  int n;
+  struct slabinfo si[NSLAB];
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  if(n < 0)
+    return -1;
+  if(n > NSLAB)
+    n = NSLAB;
+  n = slabstats(si, n);
+  if(copyout(myproc()->pagetable, addr, (char*)si, n * sizeof(si[0])) < 0)
+    return -1;
+  return n;
+}
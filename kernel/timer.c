@@ -0,0 +1,152 @@
+// Timer wheel.
+//
+// Pending timers hang off a hierarchical timer wheel, so that
+// clockintr() only looks at the timers that are due instead
+// of waking every process that waits for some tick.
+//
+// Level 0 has one slot for each of the next WHEELSIZE ticks,
+// and each level above has slots WHEELSIZE times as wide.
+// Whenever a level wraps around, the next slot of the level
+// above is cascaded: its timers are put back on the wheel,
+// closer to level 0. Adding or removing a timer is O(1), and
+// each tick costs O(1) plus the timers that are due.
+//
+// tickslock protects the wheel.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "timer.h"
+#include "defs.h"
+
+#define WHEELBITS 6
+#define WHEELSIZE (1 << WHEELBITS)
+#define WHEELMASK (WHEELSIZE - 1)
+#define NLEVEL    4
+#define MAXDELTA  ((1U << (NLEVEL * WHEELBITS)) - 1)
+
+struct {
+  struct timer *slot[NLEVEL][WHEELSIZE];
+  uint now;             // Next tick to run timers for
+} wheel;
+
+static void
+slot_link(struct timer **slot, struct timer *t)
+{
+  t->next = *slot;
+  if(t->next)
+    t->next->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+}
+
+static void
+slot_unlink(struct timer *t)
+{
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+}
+
+// Put t in the slot of the lowest level that reaches
+// t->expires. Timers further out than the whole wheel go
+// in the top level and are cascaded again when it wraps.
+static void
+wheel_add(struct timer *t)
+{
+  uint delta = t->expires - wheel.now;
+  uint when;
+  int lv;
+
+  if((int)delta < 0){
+    // already due: run it on the next tick.
+    slot_link(&wheel.slot[0][wheel.now & WHEELMASK], t);
+    return;
+  }
+  if(delta > MAXDELTA)
+    delta = MAXDELTA;
+  when = wheel.now + delta;
+  for(lv = 0; lv < NLEVEL - 1 && delta >= 1U << ((lv + 1) * WHEELBITS); lv++)
+    ;
+  slot_link(&wheel.slot[lv][(when >> (lv * WHEELBITS)) & WHEELMASK], t);
+}
+
+// Re-add the timers of slot idx of level lv, which is due
+// to be spread over the levels below.
+static void
+cascade(int lv, int idx)
+{
+  struct timer *t, *next;
+
+  t = wheel.slot[lv][idx];
+  wheel.slot[lv][idx] = 0;
+  for(; t; t = next){
+    next = t->next;
+    wheel_add(t);
+  }
+}
+
+// Arrange for fn(arg) to be called from clockintr() once
+// ticks reaches expires. Caller must hold tickslock.
+void
+timer_add(struct timer *t, uint expires, void (*fn)(void*), void *arg)
+{
+  if(!holding(&tickslock))
+    panic("timer_add");
+  if(t->pending)
+    panic("timer_add pending");
+  t->expires = expires;
+  t->fn = fn;
+  t->arg = arg;
+  t->pending = 1;
+  wheel_add(t);
+}
+
+// Cancel t if it has not run yet. Caller must hold tickslock.
+void
+timer_del(struct timer *t)
+{
+  if(!holding(&tickslock))
+    panic("timer_del");
+  if(t->pending){
+    slot_unlink(t);
+    t->pending = 0;
+  }
+}
+
+// Run the timers that are due. Called by clockintr() with
+// tickslock held, after it advances ticks.
+void
+timer_tick(void)
+{
+  struct timer *t, *next;
+  int lv;
+
+  while((int)(ticks - wheel.now) >= 0){
+    for(lv = 1; lv < NLEVEL; lv++){
+      if((wheel.now & ((1U << (lv * WHEELBITS)) - 1)) != 0)
+        break;
+      cascade(lv, (wheel.now >> (lv * WHEELBITS)) & WHEELMASK);
+    }
+
+    t = wheel.slot[0][wheel.now & WHEELMASK];
+    wheel.slot[0][wheel.now & WHEELMASK] = 0;
+    // a timer that fn re-adds for now lands on the next tick.
+    wheel.now++;
+    for(; t; t = next){
+      next = t->next;
+      t->pending = 0;
+      t->fn(t->arg);
+    }
+  }
+}
+
+// A timer function that wakes up processes sleeping on chan.
+void
+timer_wakeup(void *chan)
+{
+  wakeup(chan);
+}
@@ -0,0 +1,9 @@
+// One-shot timers, run by clockintr() once ticks reaches expires.
+struct timer {
+  uint expires;         // Tick at which to call fn
+  void (*fn)(void*);    // Called with tickslock held; must not sleep
+  void *arg;
+  int pending;          // Is the timer on the wheel?
+  struct timer *next;   // Wheel slot links
+  struct timer **pprev;
+};
@@ -5,20 +5,39 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "kstats.h"
 
 struct spinlock tickslock;
 uint ticks;
 
 extern char trampoline[], uservec[], userret[];
-#ifdef MLFQ
-  extern struct Queue mlfq[NUMQ];
-#endif
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
 extern int devintr();
 
+// usercopy.S: where to go on in routines that fault on
+// user memory.
+struct extable {
+  uint64 start, end;  // pcs [start, end)
+  uint64 fixup;
+};
+extern struct extable extable[], extable_end[];
+
+// Return the fixup for a fault at kernel pc, or 0 if a
+// fault there is a kernel bug.
+static uint64
+extable_lookup(uint64 pc)
+{
+  struct extable *e;
+
+  for(e = extable; e < extable_end; e++)
+    if(pc >= e->start && pc < e->end)
+      return e->fixup;
+  return 0;
+}
+
 void trapinit(void)
 {
   initlock(&tickslock, "time");
@@ -71,12 +90,8 @@ void usertrap(void)
   {
     // ok
   }
-  else if(r_scause() == 15 || r_scause() == 13)
+  else if(r_scause() == 15 || r_scause() == 13 || r_scause() == 12)
   {
-    if(r_stval() == 0)
-    {
-      p->killed = 1;
-    }
     int res = page_fault_handler((void*)r_stval(),p->pagetable);
     if(res == -1 || res==-2){
       p->killed=1;
@@ -116,18 +131,16 @@ void usertrap(void)
     
     if(p->runtime >= 1 << p->qnum)
     {
-      p->qnum = (p->qnum + 1)%NUMQ;
+      if(p->qnum < NUMQ - 1)
+        p->qnum++;
 
      yield();
 
     }
-    preemptandaging();
-    for(int i = 0 ; i < p->qnum ;i++)
+    runq_age();
+    if(runq_waiting(p->qnum))
     {
-      if(mlfq[i].size)
-      {
-        yield();
-      }
+      yield();
     }
     // if(p->qnum == NUMQ - 1)
     // {      
@@ -160,6 +173,7 @@ void usertrapret(void)
 
   // set up trapframe values that uservec will need when
   // the process next traps into the kernel.
+  kvmswitch(p);   // exec() or ASID recycling may have changed it
   p->trapframe->kernel_satp = r_satp();         // kernel page table
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
@@ -172,13 +186,16 @@ void usertrapret(void)
   unsigned long x = r_sstatus();
   x &= ~SSTATUS_SPP; // clear SPP to 0 for user mode
   x |= SSTATUS_SPIE; // enable interrupts in user mode
+  x &= ~SSTATUS_SUM; // only copy_user() and the like touch user memory
   w_sstatus(x);
 
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = MAKE_SATP(p->pagetable) | (r_satp() & SATP_ASIDMASK);
+  if((satp & SATP_ASIDMASK) == 0)
+    __sync_fetch_and_add(&kstats.tlbflushes, 1);  // trampoline.S flushes
 
   // jump to userret in trampoline.S at the top of memory, which
   // switches to the user page table, restores user registers,
@@ -195,13 +212,21 @@ void kerneltrap()
   uint64 sepc = r_sepc();
   uint64 sstatus = r_sstatus();
   uint64 scause = r_scause();
+  uint64 fixup;
 
   if ((sstatus & SSTATUS_SPP) == 0)
     panic("kerneltrap: not from supervisor mode");
   if (intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if ((which_dev = devintr()) == 0)
+  if ((scause == 13 || scause == 15) && (fixup = extable_lookup(sepc)) != 0)
+  {
+    // a fault on user memory in copy_user() or the like:
+    // map the page and retry, or give up at the fixup.
+    if (page_fault_handler((void*)r_stval(), myproc()->pagetable) != 0)
+      sepc = fixup;
+  }
+  else if ((which_dev = devintr()) == 0)
   {
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -222,19 +247,15 @@ void kerneltrap()
 
     if(p->runtime >= 1 << p->qnum)
     {
-      p->qnum = (p->qnum + 1)%NUMQ;
+      if(p->qnum < NUMQ - 1)
+        p->qnum++;
 
       yield();
     }
-    preemptandaging();
-    for(int i = 0 ; i < p->qnum ;i++)
+    runq_age();
+    if(runq_waiting(p->qnum))
     {
-      if(mlfq[i].size)
-      {
-
-        yield();
-
-      }
+      yield();
     }
     // if(p->qnum == NUMQ - 1)
     // {
@@ -249,13 +270,35 @@ void kerneltrap()
   w_sstatus(sstatus);
 }
 
+extern uint64 timer_scratch[NCPU][7];
+
+// Stop this hart's timer interrupts, while it is idle.
+void timeroff(void)
+{
+  *(uint64*)DEVVA(CLINT_MTIMECMP(cpuid())) = -1;
+}
+
+// Restart this hart's timer interrupts after timeroff().
+void timeron(void)
+{
+  int id = cpuid();
+  *(uint64*)DEVVA(CLINT_MTIMECMP(id)) = *(uint64*)DEVVA(CLINT_MTIME) + timer_scratch[id][4];
+}
+
+// Interrupt hart id with a supervisor software interrupt,
+// by way of timervec in kernelvec.S.
+void sendipi(int id)
+{
+  *(uint32*)DEVVA(CLINT_MSIP(id)) = 1;
+}
+
 void clockintr()
 {
 
   acquire(&tickslock);
   ticks++;
   update_time();
-  wakeup(&ticks);
+  timer_tick();
   release(&tickslock);
 }
 
@@ -299,18 +342,26 @@ int devintr()
   }
   else if (scause == 0x8000000000000001L)
   {
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or IPI, forwarded by timervec in kernelvec.S.
+
+    // acknowledge the software interrupt by clearing
+    // the SSIP bit in sip. do it before looking at the
+    // timer flag, so that a tick arriving in between
+    // raises another interrupt rather than being lost.
+    w_sip(r_sip() & ~2);
+
+    if (__sync_lock_test_and_set(&timer_scratch[cpuid()][6], 0) == 0)
+    {
+      // just an IPI; the scheduler will look at its queue.
+      return 1;
+    }
 
     if (cpuid() == 0)
     {
       clockintr();
     }
 
-    // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
-    w_sip(r_sip() & ~2);
-
     return 2;
   }
   else
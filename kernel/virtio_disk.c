@@ -15,9 +15,10 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "kstats.h"
 
 // the address of virtio mmio register r.
-#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
+#define R(r) ((volatile uint32 *)(DEVVA(VIRTIO0) + (r)))
 
 static struct disk {
   // a set (not a ring) of DMA descriptors, with which the
@@ -46,15 +47,25 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b;   // the first of the request's bufs
     char status;
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
+
+  // if the device takes indirect descriptors, each request
+  // takes just one ring descriptor, which points to the
+  // request's own in a table here. so NUM requests, not
+  // NUM/3, can be in flight.
+  int indirect;
+  struct virtq_desc table[NUM][MAXSEG+2];
+  int inflight;    // requests the device has
   
   struct spinlock vdisk_lock;
+
+  uint64 capacity; // in 512-byte sectors
   
 } disk;
 
@@ -91,8 +102,8 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.indirect = (features >> VIRTIO_RING_F_INDIRECT_DESC) & 1;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -117,15 +128,16 @@ virtio_disk_init(void)
   if(max < NUM)
     panic("virtio disk max queue too short");
 
-  // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
-  if(!disk.desc || !disk.avail || !disk.used)
+  // allocate and zero queue memory: one contiguous block,
+  // in the legacy layout of descriptors, then the avail
+  // ring, then the used ring on the next page.
+  char *q = kalloc_order(1);
+  if(q == 0)
     panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
+  memset(q, 0, 2*PGSIZE);
+  disk.desc = (struct virtq_desc *)q;
+  disk.avail = (struct virtq_avail *)(q + NUM*sizeof(struct virtq_desc));
+  disk.used = (struct virtq_used *)(q + PGSIZE);
 
   // set queue size.
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
@@ -141,6 +153,9 @@ virtio_disk_init(void)
   // queue is ready.
   *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
 
+  // the block device's configuration starts with its size.
+  disk.capacity = *R(VIRTIO_MMIO_CONFIG) | (uint64)*R(VIRTIO_MMIO_CONFIG + 4) << 32;
+
   // all NUM descriptors start out unused.
   for(int i = 0; i < NUM; i++)
     disk.free[i] = 1;
@@ -196,12 +211,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+allocn_desc(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +226,54 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Size of the disk in blocks. Blocks past the file system's
+// hold swap; see swap.c.
+uint
+virtio_disk_size(void)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  return disk.capacity / (BSIZE / 512);
+}
 
+// Start transferring the n segments data[i], of len[i] bytes
+// each, to or from the disk from sector on, for the bufs linked
+// through b->qnext, in one request. virtio_disk_intr() finishes
+// them when it is over. Caller holds disk.vdisk_lock.
+static void
+virtio_disk_submit(struct buf *b, uint64 sector, char **data, uint *len, int n, int write)
+{
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
+  // a descriptor for type/reserved/sector, one for each segment
+  // of data, and one for a 1-byte status result. with indirect
+  // descriptors, those are in a table that one descriptor of
+  // the ring points to.
+  int idx[MAXSEG+2], nd = disk.indirect ? 1 : n + 2;
+  struct virtq_desc *d[MAXSEG+2];
+  struct buf *x;
+
+  if(n < 1 || n > MAXSEG)
+    panic("virtio_disk_submit");
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(allocn_desc(idx, nd) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
+  if(disk.indirect){
+    for(int i = 0; i < n + 2; i++){
+      d[i] = &disk.table[idx[0]][i];
+      if(i > 0)
+        idx[i] = i;   // the next fields index the table
+    }
+    disk.desc[idx[0]].addr = (uint64) disk.table[idx[0]];
+    disk.desc[idx[0]].len = (n + 2) * sizeof(struct virtq_desc);
+    disk.desc[idx[0]].flags = VRING_DESC_F_INDIRECT;
+    disk.desc[idx[0]].next = 0;
+  } else {
+    for(int i = 0; i < n + 2; i++)
+      d[i] = &disk.desc[idx[i]];
+  }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -244,28 +285,31 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
+  d[0]->addr = (uint64) buf0;
+  d[0]->len = sizeof(struct virtio_blk_req);
+  d[0]->flags = VRING_DESC_F_NEXT;
+  d[0]->next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 1; i <= n; i++){
+    d[i]->addr = (uint64) data[i-1];
+    d[i]->len = len[i-1];
+    if(write)
+      d[i]->flags = 0; // device reads the data
+    else
+      d[i]->flags = VRING_DESC_F_WRITE; // device writes the data
+    d[i]->flags |= VRING_DESC_F_NEXT;
+    d[i]->next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  d[n+1]->addr = (uint64) &disk.info[idx[0]].status;
+  d[n+1]->len = 1;
+  d[n+1]->flags = VRING_DESC_F_WRITE; // device writes the status
+  d[n+1]->next = 0;
 
   // record struct buf for virtio_disk_intr().
-  b->disk = 1;
+  for(x = b; x; x = x->qnext)
+    x->disk = 1;
   disk.info[idx[0]].b = b;
 
   // tell the device the first index in our chain of descriptors.
@@ -280,15 +324,61 @@ virtio_disk_rw(struct buf *b, int write)
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  disk.inflight++;
+  kstats.diskreqs++;
+  kstats.diskqdepth += disk.inflight;
+}
+
+// Start reading or writing the bufs linked through b->qnext,
+// which the caller has locked and which hold consecutive blocks
+// from b's on, in one request, and return without waiting. When
+// the disk is done, virtio_disk_intr() calls each one's done(),
+// in interrupt context, or, if that is 0, wakes up
+// virtio_disk_wait() for it.
+void
+virtio_disk_start(struct buf *b, int write)
+{
+  char *data[MAXSEG];
+  uint len[MAXSEG];
+  struct buf *x;
+  int n = 0;
+
+  for(x = b; x; x = x->qnext){
+    if(n == MAXSEG)
+      panic("virtio_disk_start");
+    data[n] = (char *) x->data;
+    len[n++] = BSIZE;
+  }
+  acquire(&disk.vdisk_lock);
+  virtio_disk_submit(b, (uint64)b->blockno * (BSIZE / 512), data, len, n, write);
+  release(&disk.vdisk_lock);
+}
+
+// Wait for the disk to be done with b.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
+  release(&disk.vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+// Read or write the page at pa from or to the disk, starting
+// at block blockno, in one request. b is only used to wait on.
+void
+virtio_disk_rwpage(struct buf *b, void *pa, uint blockno, int write)
+{
+  char *data = pa;
+  uint len = PGSIZE;
 
+  b->qnext = 0;
+  b->done = 0;
+  acquire(&disk.vdisk_lock);
+  virtio_disk_submit(b, (uint64)blockno * (BSIZE / 512), &data, &len, 1, write);
   release(&disk.vdisk_lock);
+  virtio_disk_wait(b);
 }
 
 void
@@ -316,9 +406,18 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    struct buf *b = disk.info[id].b, *next;
+    disk.info[id].b = 0;
+    free_chain(id);
+    disk.inflight--;
+    for(; b; b = next){
+      next = b->qnext;   // once done, b may be reused
+      b->disk = 0;   // disk is done with buf
+      if(b->done)
+        b->done(b);
+      else
+        wakeup(b);
+    }
 
     disk.used_idx += 1;
   }
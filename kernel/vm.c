@@ -5,6 +5,9 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "kstats.h"
 
 /*
  * the kernel's page table.
@@ -15,28 +18,36 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// usercopy.S
+int copy_user(void *dst, const void *src, uint64 n);
+int copyinstr_user(char *dst, const char *src, uint64 max);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kzalloc();
 
   // uart registers
-  kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, DEVVA(UART0), UART0, PGSIZE, PTE_R | PTE_W);
 
   // virtio mmio disk interface
-  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, DEVVA(VIRTIO0), VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
   // PLIC
-  kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
+  kvmmap(kpgtbl, DEVVA(PLIC), PLIC, 0x400000, PTE_R | PTE_W);
+
+  // CLINT, for IPIs and for idle harts to stop their timers.
+  kvmmap(kpgtbl, DEVVA(CLINT), CLINT, 0x10000, PTE_R | PTE_W);
 
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // kvmmap() uses megapages for all of it past the first 2MB
+  // boundary, so kernel accesses to RAM rarely miss in the TLB.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -45,10 +56,41 @@ kvmmake(void)
 
   // allocate and map a kernel stack for each process.
   proc_mapstacks(kpgtbl);
+
+  // each process's kernel page table puts its user memory here.
+  for(int i = 0; i < PX(2, MAXUVA); i++)
+    if(kpgtbl[i] & PTE_V)
+      panic("kvmmake: user range");
   
   return kpgtbl;
 }
 
+// Make a kernel page table for a process with user page
+// table upt: the kernel's mappings, and upt's below MAXUVA,
+// so that copyin() and copyout() can use user addresses
+// directly. Shares all but the top-level page-table page.
+// Returns 0 if out of memory.
+pagetable_t
+kvmcreate(pagetable_t upt)
+{
+  pagetable_t kpt;
+
+  if((kpt = (pagetable_t)kalloc()) == 0)
+    return 0;
+  memmove(kpt, kernel_pagetable, PGSIZE);
+  kvmsync(kpt, upt);
+  return kpt;
+}
+
+// Point kernel page table kpt at user page table upt's memory.
+// The caller flushes the TLB if kpt is in use.
+void
+kvmsync(pagetable_t kpt, pagetable_t upt)
+{
+  for(int i = 0; i < PX(2, MAXUVA); i++)
+    kpt[i] = upt[i];
+}
+
 // Initialize the one kernel_pagetable
 void
 kvminit(void)
@@ -70,9 +112,38 @@ kvminithart()
   sfence_vma();
 }
 
+// Return the address of the level *level PTE in page table
+// pagetable that corresponds to virtual address va. If alloc!=0,
+// create any required page-table pages. If a leaf PTE, a
+// megapage, turns up above level *level, return that instead,
+// and set *level to its level.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int *level, int alloc)
+{
+  if(va >= MAXVA)
+    panic("walk");
+
+  for(int l = 2; l > *level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        *level = l;
+        return pte;
+      }
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if(!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
+        return 0;
+      *pte = PA2PTE(pagetable) | PTE_V;
+    }
+  }
+  return &pagetable[PX(*level, va)];
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// create any required page-table pages. If va is in a
+// megapage, return the megapage's level-1 PTE.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -85,21 +156,23 @@ kvminithart()
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
-  if(va >= MAXVA)
-    panic("walk");
+  int level = 0;
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
-      pagetable = (pagetable_t)PTE2PA(*pte);
-    } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
-        return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
-    }
-  }
-  return &pagetable[PX(0, va)];
+  return walklevel(pagetable, va, &level, alloc);
+}
+
+// Return the level-1 PTE of the megapage that va is in,
+// or 0 if va isn't mapped by a megapage.
+pte_t *
+megapte(pagetable_t pagetable, uint64 va)
+{
+  int level = 1;
+  pte_t *pte;
+
+  pte = walklevel(pagetable, va, &level, 0);
+  if(pte == 0 || level != 1 || (*pte & PTE_V) == 0 || !PTE_LEAF(*pte))
+    return 0;
+  return pte;
 }
 
 // Look up a virtual address, return the physical address,
@@ -110,11 +183,12 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level = 0;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, &level, 0);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
@@ -122,17 +196,57 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(level == 1)
+    pa += PGROUNDDOWN(va) & (MEGASIZE - 1);
   return pa;
 }
 
-// add a mapping to the kernel page table.
+// add a mapping to the kernel page table, with megapages
+// where va and pa are both aligned for them.
 // only used when booting.
 // does not flush TLB or enable paging.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 n;
+
+  while(sz > 0){
+    if(va % MEGASIZE == 0 && pa % MEGASIZE == 0 && sz >= MEGASIZE){
+      n = MEGASIZE;
+      if(mapmega(kpgtbl, va, pa, perm) != 0)
+        panic("kvmmap");
+    } else {
+      // pages up to the next megapage boundary.
+      n = MEGAROUNDDOWN(va + MEGASIZE) - va;
+      if(n > sz)
+        n = sz;
+      if(mappages(kpgtbl, va, n, pa, perm) != 0)
+        panic("kvmmap");
+    }
+    va += n;
+    pa += n;
+    sz -= n;
+  }
+}
+
+// Create a level-1 leaf PTE that maps the megapage at
+// virtual address va to physical address pa. Both must be
+// MEGASIZE-aligned. Returns 0 on success, -1 if walklevel()
+// couldn't allocate a needed page-table page.
+int
+mapmega(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  int level = 1;
+  pte_t *pte;
+
+  if(va % MEGASIZE != 0 || pa % MEGASIZE != 0)
+    panic("mapmega: not aligned");
+  if((pte = walklevel(pagetable, va, &level, 1)) == 0)
+    return -1;
+  if(*pte & PTE_V)
+    panic("mapmega: remap");
+  *pte = PA2PTE(pa) | perm | PTE_V;
+  return 0;
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -172,15 +286,34 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
   uint64 a;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+    // heap pages that were never touched aren't mapped.
+    level = 0;
+    if((pte = walklevel(pagetable, a, &level, 0)) == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      if(do_free)
+        swapfree(PTE2SLOT(*pte));
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
+    if(level == 1){
+      // callers split a megapage they unmap only part of.
+      if(a % MEGASIZE != 0 || a + MEGASIZE > va + npages*PGSIZE)
+        panic("uvmunmap: part of a megapage");
+      if(do_free)
+        kfree_mega((void*)PTE2PA(*pte));
+      *pte = 0;
+      a += MEGASIZE - PGSIZE;
+      continue;
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -196,11 +329,21 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 pagetable_t
 uvmcreate()
 {
-  pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable_t pagetable, l1;
+  pagetable = (pagetable_t) kzalloc();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
+  // the level-1 page tables for user memory come first, and
+  // last as long as pagetable: kvmsync() copies them.
+  for(int i = 0; i < PX(2, MAXUVA); i++){
+    if((l1 = (pagetable_t) kzalloc()) == 0){
+      while(--i >= 0)
+        kfree((void*)PTE2PA(pagetable[i]));
+      kfree(pagetable);
+      return 0;
+    }
+    pagetable[i] = PA2PTE(l1) | PTE_V;
+  }
   return pagetable;
 }
 
@@ -214,8 +357,7 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -233,12 +375,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -248,6 +389,29 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
   return newsz;
 }
 
+// Like uvmalloc(), for writable memory, but map the new pages
+// copy-on-write to the shared zero page, so that each one gets
+// a page of its own only when it is first written.
+uint64
+uvmalloczero(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
+{
+  uint64 a;
+
+  if(newsz < oldsz)
+    return oldsz;
+
+  oldsz = PGROUNDUP(oldsz);
+  for(a = oldsz; a < newsz; a += PGSIZE){
+    if(mappages(pagetable, a, PGSIZE, (uint64)zeropage, PTE_R|PTE_U|PTE_COW|(xperm & ~PTE_W)) != 0){
+      uvmdealloc(pagetable, a, oldsz);
+      return 0;
+    }
+    pagereference_increase(zeropage);
+    __sync_fetch_and_add(&kstats.zeromaps, 1);
+  }
+  return newsz;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -303,24 +467,45 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int share)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
+  int level;
   // char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+  for(i = start; i < end; i += PGSIZE){
+    // the child faults in untouched heap pages itself.
+    level = 0;
+    if((pte = walklevel(old, i, &level, 0)) == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      // share the slot; each reads its own copy back.
+      pte_t *npte;
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      swapdup(PTE2SLOT(*pte));
+      *npte = *pte;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if(flags&PTE_W){
+    if((flags&PTE_W) && !share){
       flags = (flags&(~PTE_W))|PTE_COW;
       *pte = PA2PTE(pa)|flags;
     }
+    if(level == 1){
+      // share the whole megapage; a write splits it.
+      if(mapmega(new, i, pa, flags) != 0)
+        goto err;
+      for(int j = 0; j < (1 << MEGAORDER); j++)
+        pagereference_increase((void*)(pa + j*PGSIZE));
+      i += MEGASIZE - PGSIZE;
+      continue;
+    }
     if(mappages(new, i, PGSIZE, pa, flags) != 0){
        goto err;
      }
@@ -330,21 +515,147 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
-// mark a PTE invalid for user access.
-// used by exec for the user stack guard page.
-void
-uvmclear(pagetable_t pagetable, uint64 va)
+// Split the megapage that va is in, if any, into pages with the
+// same permissions, so that they can be changed one at a time.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmdemote(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  
-  pte = walk(pagetable, va, 0);
-  if(pte == 0)
-    panic("uvmclear");
-  *pte &= ~PTE_U;
+  pagetable_t table;
+  uint64 pa, flags;
+
+  if((pte = megapte(pagetable, va)) == 0)
+    return 0;
+  if((table = (pagetable_t)kalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = PTE_FLAGS(*pte);
+  // each page already has a reference for this mapping.
+  for(int i = 0; i < 512; i++)
+    table[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(table) | PTE_V;
+  __sync_fetch_and_add(&kstats.megademotes, 1);
+  return 0;
+}
+
+// Map the MEGASIZE-aligned region around va, which the caller
+// has checked is all heap, with a megapage, if every page of it
+// but va's is mapped by now, as private, writable heap pages.
+// They are copied into it, and va's page is zeroed. Returns 0
+// on success, -1 if the region doesn't qualify yet or there is
+// no free megapage.
+int
+uvmpromote(pagetable_t pagetable, uint64 va)
+{
+  int level = 1, idx = PX(0, va);
+  pte_t *pte;
+  pagetable_t table;
+  char *mem;
+  uint64 pa;
+
+  va = MEGAROUNDDOWN(va);
+  if((pte = walklevel(pagetable, va, &level, 0)) == 0 || level != 1 ||
+     (*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+    return -1;
+  table = (pagetable_t)PTE2PA(*pte);
+  // a neighbour first: a sweep through the region finds one of
+  // them missing until its last page.
+  if((idx > 0 && (table[idx-1] & PTE_V) == 0) ||
+     (idx < 511 && (table[idx+1] & PTE_V) == 0))
+    return -1;
+  for(int i = 0; i < 512; i++){
+    if(i == idx)
+      continue;
+    if((table[i] & (PTE_V|PTE_R|PTE_W|PTE_X|PTE_U|PTE_COW)) != (PTE_V|PTE_R|PTE_W|PTE_U) ||
+       get_pagereference((void*)PTE2PA(table[i])) != 1)
+      return -1;
+  }
+
+  if((mem = kalloc_mega()) == 0)
+    return -1;
+  for(int i = 0; i < 512; i++){
+    if(i == idx){
+      memset(mem + i*PGSIZE, 0, PGSIZE);
+    } else {
+      pa = PTE2PA(table[i]);
+      memmove(mem + i*PGSIZE, (void*)pa, PGSIZE);
+      kfree((void*)pa);
+    }
+  }
+  kfree((void*)table);
+  *pte = PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_V;
+  __sync_fetch_and_add(&kstats.megapromotes, 1);
+  return 0;
+}
+
+// Make child's page table map parent's user memory, for vfork(),
+// by sharing the page-table pages below the top level. Child
+// keeps its own top-level entry for the trampoline and trapframe.
+// Returns 0 on success, -1 on failure.
+int
+uvmborrow(pagetable_t parent, pagetable_t child, uint64 sz)
+{
+  uint64 va;
+
+  if(sz > 0 && PX(2, sz - 1) >= PX(2, TRAPFRAME))
+    return -1;
+  // fill in parent's top-level entries up to sz first, so that
+  // page tables the child adds there are parent's too.
+  for(va = 0; va < sz; va += 1L << PXSHIFT(2))
+    if(walk(parent, va, 1) == 0)
+      return -1;
+  for(int i = 0; i < PX(2, TRAPFRAME); i++){
+    // child's own page tables here map nothing yet.
+    if(child[i] & PTE_V)
+      freewalk((pagetable_t)PTE2PA(child[i]));
+    child[i] = parent[i];
+  }
+  return 0;
+}
+
+// Stop child's page table from sharing memory set up by uvmborrow().
+void
+uvmunborrow(pagetable_t child)
+{
+  for(int i = 0; i < PX(2, TRAPFRAME); i++)
+    child[i] = 0;
+}
+
+// Like walkaddr(), but first fault in va if it is heap
+// memory that the process hasn't touched yet.
+static uint64
+uvmfaultaddr(pagetable_t pagetable, uint64 va)
+{
+  uint64 pa;
+
+  if((pa = walkaddr(pagetable, va)) == 0 &&
+     page_fault_handler((void*)va, pagetable) == 0)
+    pa = walkaddr(pagetable, va);
+  return pa;
+}
+
+// If va is in the heap or a mapping of the current process,
+// whose kernel page table maps them, given by pagetable, return
+// the end of that, up to which copy_user() can get at it
+// directly. Otherwise return 0.
+static uint64
+uvmdirect(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if(p == 0 || pagetable != p->pagetable)
+    return 0;
+  if(va < p->sz)
+    return p->sz;
+  if((v = mmapfind(p, va)) != 0)
+    return v->end;
+  return 0;
 }
 
 // Copy from kernel to user.
@@ -353,17 +664,26 @@ uvmclear(pagetable_t pagetable, uint64 va)
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
-  uint64 n, va0, pa0,flags;
+  uint64 n, va0, pa0,flags, end;
   pte_t * pte;
+
+  // pages that aren't there or are copy-on-write fault,
+  // and the fault handler maps or copies them.
+  if((end = uvmdirect(pagetable, dstva)) != 0 && len <= end - dstva)
+    return copy_user((void*)dstva, src, len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmfaultaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
         pte = walk(pagetable,va0,0);
     flags=PTE_FLAGS(*pte);
+    if((flags & (PTE_W|PTE_COW)) == 0)
+      return -1;
     if(flags&PTE_COW){
-      page_fault_handler((void*)va0,pagetable);
+      if(page_fault_handler((void*)va0,pagetable) < 0)
+        return -1;
       pa0 = walkaddr(pagetable,va0);
     }
     n = PGSIZE - (dstva - va0);
@@ -384,11 +704,14 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
-  uint64 n, va0, pa0;
+  uint64 n, va0, pa0, end;
+
+  if((end = uvmdirect(pagetable, srcva)) != 0 && len <= end - srcva)
+    return copy_user(dst, (void*)srcva, len);
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmfaultaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -410,12 +733,18 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
+  uint64 n, va0, pa0, end;
   int got_null = 0;
 
+  if((end = uvmdirect(pagetable, srcva)) != 0){
+    if(max > end - srcva)
+      max = end - srcva;
+    return copyinstr_user(dst, (char*)srcva, max);
+  }
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmfaultaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
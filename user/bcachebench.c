@@ -0,0 +1,139 @@
+// Buffer cache contention benchmark: a parallel stressfs.
+//
+// Runs 1, 2, 4 and 8 processes that each read their own small
+// file over and over, so nearly every block they ask for is
+// in the buffer cache, and reports the time taken and how often
+// a buffer cache lock was found held. Boot with CPUS=4 or more
+// for the processes to really run in parallel.
+//
+// Then it reads a file much bigger than the old 30-block cache
+// twice, and reports how many of its blocks the second pass
+// found in the cache.
+//
+// usage: bcachebench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+#define ROUNDS 500
+#define FILESIZE 2048     // two blocks, so all the files stay cached
+#define BIGSIZE (512*1024)
+
+char buf[FILESIZE];
+
+void
+worker(int i, int rounds)
+{
+  char path[] = "bcbench0";
+  int fd;
+
+  path[7] += i;
+  if((fd = open(path, O_CREATE | O_RDWR)) < 0 ||
+     write(fd, buf, FILESIZE) != FILESIZE){
+    printf("bcachebench: create %s failed\n", path);
+    exit(1);
+  }
+  close(fd);
+  for(int r = 0; r < rounds; r++){
+    if((fd = open(path, O_RDONLY)) < 0 || read(fd, buf, FILESIZE) != FILESIZE){
+      printf("bcachebench: read %s failed\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+  unlink(path);
+  exit(0);
+}
+
+void
+run(int nproc, int rounds)
+{
+  struct kstats before, after;
+  int start, elapsed;
+
+  kstats(&before);
+  start = uptime();
+  for(int i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("bcachebench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      worker(i, rounds);
+  }
+  for(int i = 0; i < nproc; i++)
+    wait(0);
+  elapsed = uptime() - start;
+  kstats(&after);
+
+  printf("%d process(es): %d ticks, %d hits, %d misses, %d lock spins\n",
+         nproc, elapsed,
+         (int)(after.bcachehits - before.bcachehits),
+         (int)(after.bcachemisses - before.bcachemisses),
+         (int)(after.bcachespins - before.bcachespins));
+}
+
+// Read the big file; return the buffer cache misses it took.
+int
+readbig(void)
+{
+  struct kstats before, after;
+  int fd, n;
+
+  kstats(&before);
+  if((fd = open("bcbig", O_RDONLY)) < 0){
+    printf("bcachebench: open bcbig failed\n");
+    exit(1);
+  }
+  while((n = read(fd, buf, FILESIZE)) > 0)
+    ;
+  close(fd);
+  kstats(&after);
+  return after.bcachemisses - before.bcachemisses;
+}
+
+void
+reread(void)
+{
+  int fd, first, second;
+
+  if((fd = open("bcbig", O_CREATE | O_RDWR)) < 0){
+    printf("bcachebench: create bcbig failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < BIGSIZE; i += FILESIZE)
+    if(write(fd, buf, FILESIZE) != FILESIZE){
+      printf("bcachebench: write bcbig failed\n");
+      exit(1);
+    }
+  close(fd);
+  first = readbig();
+  second = readbig();
+  unlink("bcbig");
+  printf("%d KB file: %d misses reading it, %d reading it again\n",
+         BIGSIZE / 1024, first, second);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = ROUNDS;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds <= 0){
+    fprintf(2, "usage: bcachebench [rounds]\n");
+    exit(1);
+  }
+
+  memset(buf, 'b', sizeof(buf));
+  run(1, rounds);
+  run(2, rounds);
+  run(4, rounds);
+  run(8, rounds);
+  reread();
+  exit(0);
+}
@@ -0,0 +1,91 @@
+// Copy-on-write fault benchmark.
+//
+// Runs 1, 2 and 4 workers at once. Each worker dirties NPAGES
+// pages, then repeatedly forks a child that writes to every one
+// of them, taking a copy-on-write fault per page, and exits.
+// Reports the total COW faults per second. Boot with
+// make qemu CPUS=4 to see how well the faults scale across harts.
+//
+// usage: cowbench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NPAGES 64
+#define PGSIZE 4096
+#define ROUNDS 50
+#define TICKSPERSEC 10   // timerinit() interrupts about every 1/10th second
+
+void
+worker(int rounds)
+{
+  char *mem = sbrk(NPAGES * PGSIZE);
+
+  if(mem == (char*)-1){
+    printf("cowbench: sbrk failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < NPAGES; i++)
+    mem[i * PGSIZE] = 1;
+
+  for(int r = 0; r < rounds; r++){
+    int pid = fork();
+    if(pid < 0){
+      printf("cowbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      for(int i = 0; i < NPAGES; i++)
+        mem[i * PGSIZE] = 2;
+      exit(0);
+    }
+    wait(0);
+  }
+}
+
+void
+run(int nworkers, int rounds)
+{
+  int start, elapsed, faults;
+
+  start = uptime();
+  for(int i = 0; i < nworkers; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("cowbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      worker(rounds);
+      exit(0);
+    }
+  }
+  for(int i = 0; i < nworkers; i++)
+    wait(0);
+  elapsed = uptime() - start;
+
+  faults = nworkers * rounds * NPAGES;
+  printf("%d worker(s): %d faults in %d ticks", nworkers, faults, elapsed);
+  if(elapsed > 0)
+    printf(", %d faults/sec", (faults * TICKSPERSEC) / elapsed);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = ROUNDS;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds <= 0){
+    fprintf(2, "usage: cowbench [rounds]\n");
+    exit(1);
+  }
+
+  run(1, rounds);
+  run(2, rounds);
+  run(4, rounds);
+  exit(0);
+}
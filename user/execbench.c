@@ -0,0 +1,56 @@
+// Program startup benchmark.
+//
+// Runs a short-lived command many times, the way sh does, with
+// its output thrown away, and reports the time per run.
+//
+// usage: execbench [runs [command [args]]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define RUNS 200
+#define USPERTICK 100000 // timerinit() interrupts about every 1/10th second
+
+char *defargv[] = { "echo", "hello", 0 };
+
+int
+main(int argc, char *argv[])
+{
+  int runs = RUNS, start, elapsed;
+  char **cmd = defargv;
+
+  if(argc > 1)
+    runs = atoi(argv[1]);
+  if(argc > 2)
+    cmd = argv + 2;
+  if(runs <= 0){
+    fprintf(2, "usage: execbench [runs [command [args]]]\n");
+    exit(1);
+  }
+
+  start = uptime();
+  for(int i = 0; i < runs; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "execbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(1);
+      open("console", O_RDONLY);  // so writes to fd 1 fail quietly
+      exec(cmd[0], cmd);
+      fprintf(2, "execbench: exec %s failed\n", cmd[0]);
+      exit(1);
+    }
+    wait(0);
+  }
+  elapsed = uptime() - start;
+
+  printf("%d runs of %s in %d ticks", runs, cmd[0], elapsed);
+  if(elapsed > 0)
+    printf(", %d us/run", (elapsed * USPERTICK) / runs);
+  printf("\n");
+  exit(0);
+}
@@ -0,0 +1,87 @@
+//
+// tests that the file of a running program, which it pages in
+// from as it runs, can't be overwritten or truncated until no
+// process is running it any more.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+char *fname = "exectest.bin";
+char buf[1024];
+
+void
+fail(char *what)
+{
+  printf("%s failed\n", what);
+  unlink(fname);
+  exit(-1);
+}
+
+// Copy the cat program to fname.
+void
+copycat(void)
+{
+  int in, out, n;
+
+  if((in = open("/cat", O_RDONLY)) < 0)
+    fail("open /cat");
+  if((out = open(fname, O_CREATE | O_WRONLY | O_TRUNC)) < 0)
+    fail("create");
+  while((n = read(in, buf, sizeof(buf))) > 0)
+    if(write(out, buf, n) != n)
+      fail("copy");
+  close(in);
+  close(out);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *args[] = { "cat", 0 };
+  int p[2], pid, fd, xstatus;
+
+  printf("running program: ");
+  copycat();
+
+  // the child runs the copy, blocked reading the pipe.
+  if(pipe(p) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(0);
+    dup(p[0]);
+    close(p[0]);
+    close(p[1]);
+    exec(fname, args);
+    exit(1);
+  }
+  close(p[0]);
+  sleep(5);
+
+  if(open(fname, O_WRONLY | O_TRUNC) >= 0)
+    fail("truncate refused");
+  if((fd = open(fname, O_WRONLY)) < 0)
+    fail("open for writing");
+  memset(buf, 0, sizeof(buf));
+  if(write(fd, buf, sizeof(buf)) >= 0)
+    fail("overwrite refused");
+  close(fd);
+
+  // the child runs on, paging in more of its program, to
+  // see the end of its input and exit.
+  close(p[1]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    fail("child ran");
+
+  if((fd = open(fname, O_WRONLY | O_TRUNC)) < 0)
+    fail("truncate after exit");
+  close(fd);
+  unlink(fname);
+  printf("ok\n");
+  printf("ALL TESTS PASSED\n");
+  exit(0);
+}
@@ -1,11 +1,18 @@
 // Test that fork fails gracefully.
 // Tiny executable so that the limit can be filling the proc table.
+//
+// forktest -t instead times fork()+exec() against vfork()+exec()
+// with the parent grown to several sizes. fork() copies the
+// parent's page tables, so its cost grows with the parent;
+// vfork() only borrows them.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 
 #define N  1000
+#define NSPAWN 200
+#define MB (1024*1024)
 
 void
 print(const char *s)
@@ -48,9 +55,85 @@ forktest(void)
   print("fork test OK\n");
 }
 
+void
+printint(int n)
+{
+  char buf[16];
+  int i = sizeof(buf);
+
+  buf[--i] = 0;
+  do {
+    buf[--i] = '0' + n % 10;
+    n /= 10;
+  } while(n > 0);
+  print(buf + i);
+}
+
+// Start NSPAWN copies of prog that exit at once, with fork
+// (or vfork) and exec, and return the ticks it took.
 int
-main(void)
+spawn(char *prog, int usevfork)
 {
+  char *argv[] = { prog, "-x", 0 };
+  int start, pid;
+
+  start = uptime();
+  for(int i = 0; i < NSPAWN; i++){
+    pid = usevfork ? vfork() : fork();
+    if(pid < 0){
+      print("fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(prog, argv);
+      print("exec failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  return uptime() - start;
+}
+
+void
+timing(char *prog)
+{
+  int sizes[] = { 0, 1, 8, 32 };
+  int grown = 0;
+  char *p;
+
+  print("fork+exec vs vfork+exec, ");
+  printint(NSPAWN);
+  print(" times each\n");
+  for(int i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    // grow and touch the heap, so fork has pages to map.
+    if(sizes[i] > grown){
+      p = sbrk((sizes[i] - grown) * MB);
+      if(p == (char*)-1){
+        print("sbrk failed\n");
+        exit(1);
+      }
+      memset(p, 1, (sizes[i] - grown) * MB);
+      grown = sizes[i];
+    }
+    print("parent +");
+    printint(sizes[i]);
+    print(" MB: fork ");
+    printint(spawn(prog, 0));
+    print(" ticks, vfork ");
+    printint(spawn(prog, 1));
+    print(" ticks\n");
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+  if(argc > 1 && strcmp(argv[1], "-t") == 0){
+    timing(argv[0]);
+    exit(0);
+  }
   forktest();
   exit(0);
 }
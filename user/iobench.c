@@ -0,0 +1,151 @@
+// Disk I/O benchmark: how many requests the disk gets per
+// second, and how many of them it has in flight at once.
+//
+// First it reads every file in /, which only goes to the disk
+// the first time after boot, while the files aren't yet in
+// the buffer cache; readi() reads ahead of it. Then it runs 1
+// and 4 processes that each write a file of their own, whose
+// log commits write their blocks all at once.
+//
+// For each, it reports the blocks moved and the disk requests
+// they took, adjacent blocks being merged into one request, the
+// ticks taken, the requests per second, taking a tick to be
+// 1/10th of a second as in qemu, and the average number of
+// requests in flight.
+//
+// usage: iobench [kilobytes per writer]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+#define WRITEKB 256
+#define CHUNK 4096
+
+char buf[CHUNK];
+
+struct kstats before;
+int start;
+
+void
+begin(void)
+{
+  kstats(&before);
+  start = uptime();
+}
+
+void
+report(char *what)
+{
+  struct kstats after;
+  int ticks, reqs, blocks;
+
+  ticks = uptime() - start;
+  kstats(&after);
+  reqs = after.diskreqs - before.diskreqs;
+  blocks = reqs + (after.diskmerges - before.diskmerges);
+  if(ticks == 0)
+    ticks = 1;
+  printf("%s: %d blocks in %d requests, %d ticks, %d IOPS, queue depth %d\n",
+         what, blocks, reqs, ticks, reqs * 10 / ticks,
+         reqs ? (int)((after.diskqdepth - before.diskqdepth) / reqs) : 0);
+}
+
+void
+readall(void)
+{
+  char path[DIRSIZ + 2];
+  struct dirent de;
+  struct stat st;
+  int dfd, fd;
+
+  if((dfd = open("/", O_RDONLY)) < 0){
+    printf("iobench: open / failed\n");
+    exit(1);
+  }
+  begin();
+  while(read(dfd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum == 0)
+      continue;
+    path[0] = '/';
+    memmove(path + 1, de.name, DIRSIZ);
+    path[DIRSIZ + 1] = 0;
+    if((fd = open(path, O_RDONLY)) < 0)
+      continue;
+    if(fstat(fd, &st) == 0 && st.type == T_FILE)
+      while(read(fd, buf, CHUNK) > 0)
+        ;
+    close(fd);
+  }
+  close(dfd);
+  report("read /");
+}
+
+void
+writer(int i, int kb)
+{
+  char path[] = "iobench0";
+  int fd;
+
+  path[7] += i;
+  if((fd = open(path, O_CREATE | O_RDWR | O_TRUNC)) < 0){
+    printf("iobench: create %s failed\n", path);
+    exit(1);
+  }
+  for(int n = 0; n < kb * 1024; n += CHUNK)
+    if(write(fd, buf, CHUNK) != CHUNK){
+      printf("iobench: write %s failed\n", path);
+      exit(1);
+    }
+  close(fd);
+  exit(0);
+}
+
+void
+writeall(int nproc, int kb)
+{
+  char what[] = "write x0";
+
+  begin();
+  for(int i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("iobench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      writer(i, kb);
+  }
+  for(int i = 0; i < nproc; i++)
+    wait(0);
+  what[7] += nproc;
+  report(what);
+
+  for(int i = 0; i < nproc; i++){
+    char path[] = "iobench0";
+    path[7] += i;
+    unlink(path);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int kb = WRITEKB;
+
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  if(kb <= 0){
+    fprintf(2, "usage: iobench [kilobytes per writer]\n");
+    exit(1);
+  }
+
+  memset(buf, 'i', sizeof(buf));
+  readall();
+  writeall(1, kb);
+  writeall(4, kb);
+  exit(0);
+}
@@ -0,0 +1,161 @@
+//
+// tests for lazy sbrk(): sbrk() should cost next to nothing
+// and use no memory until the new pages are touched.
+//
+
+#include "kernel/types.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define NPAGES 4096   // 16 MB
+#define ROUNDS 1000
+
+int
+freepages()
+{
+  struct kstats ks;
+
+  if(kstats(&ks) < 0){
+    printf("kstats() failed\n");
+    exit(-1);
+  }
+  return ks.freepages;
+}
+
+// sbrk() should neither take time nor memory, and only the
+// pages that are touched should be allocated.
+void rsstest()
+{
+  int before, after, start, elapsed;
+  char *p;
+
+  printf("rss: ");
+
+  before = freepages();
+  start = uptime();
+  for(int i = 0; i < ROUNDS; i++){
+    if(sbrk(NPAGES * PGSIZE) == (char*)-1 || sbrk(-NPAGES * PGSIZE) == (char*)-1){
+      printf("sbrk failed\n");
+      exit(-1);
+    }
+  }
+  elapsed = uptime() - start;
+
+  p = sbrk(NPAGES * PGSIZE);
+  after = freepages();
+  if(before - after > 16){
+    printf("sbrk(%d) used %d pages\n", NPAGES * PGSIZE, before - after);
+    exit(-1);
+  }
+
+  for(int i = 0; i < NPAGES; i += 16){
+    if(p[i * PGSIZE] != 0){
+      printf("new memory isn't zero\n");
+      exit(-1);
+    }
+    p[i * PGSIZE] = i;
+  }
+  after = freepages();
+  if(before - after < NPAGES / 16 || before - after > NPAGES / 16 + 32){
+    printf("touching %d pages used %d pages\n", NPAGES / 16, before - after);
+    exit(-1);
+  }
+  for(int i = 0; i < NPAGES; i += 16){
+    if(p[i * PGSIZE] != (char)i){
+      printf("wrong value\n");
+      exit(-1);
+    }
+  }
+
+  sbrk(-NPAGES * PGSIZE);
+  if(before - freepages() > 16){
+    printf("sbrk(-%d) leaked memory\n", NPAGES * PGSIZE);
+    exit(-1);
+  }
+
+  printf("ok (%d pages touched, %d sbrk pairs in %d ticks)\n",
+         NPAGES / 16, ROUNDS, elapsed);
+}
+
+// system calls read from and write to untouched pages.
+void syscalltest()
+{
+  int fds[2];
+  char *p;
+
+  printf("syscall: ");
+
+  p = sbrk(4 * PGSIZE);
+  if(pipe(fds) != 0){
+    printf("pipe() failed\n");
+    exit(-1);
+  }
+  // copyin from an untouched page: writes zeros.
+  if(write(fds[1], p, 8) != 8){
+    printf("write from untouched page failed\n");
+    exit(-1);
+  }
+  // copyout to an untouched page, across a page boundary.
+  if(read(fds[0], p + 2*PGSIZE - 4, 8) != 8){
+    printf("read into untouched page failed\n");
+    exit(-1);
+  }
+  for(int i = 0; i < 8; i++){
+    if(p[2*PGSIZE - 4 + i] != 0){
+      printf("read the wrong value\n");
+      exit(-1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-4 * PGSIZE);
+
+  printf("ok\n");
+}
+
+// fork() a process with untouched heap pages.
+void forktest()
+{
+  char *p;
+  int xstatus;
+
+  printf("fork: ");
+
+  p = sbrk(8 * PGSIZE);
+  p[3 * PGSIZE] = 42;
+  int pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(-1);
+  }
+  if(pid == 0){
+    if(p[3 * PGSIZE] != 42 || p[5 * PGSIZE] != 0){
+      printf("child read the wrong value\n");
+      exit(1);
+    }
+    p[5 * PGSIZE] = 7;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(-1);
+  if(p[5 * PGSIZE] != 0){
+    printf("child's write is visible\n");
+    exit(-1);
+  }
+  sbrk(-8 * PGSIZE);
+
+  printf("ok\n");
+}
+
+int main(int argc, char *argv[])
+{
+  rsstest();
+  syscalltest();
+  forktest();
+
+  printf("ALL LAZY TESTS PASSED\n");
+
+  exit(0);
+}
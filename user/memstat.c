@@ -0,0 +1,81 @@
+// Print the kernel's page fault and memory counters or, given
+// a command, run it and print how much each counter changed.
+//
+// usage: memstat [command [args]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+void
+print(struct kstats *a, struct kstats *b)
+{
+  printf("page faults:      %d\n", (int)(b->faults - a->faults));
+  printf("cow copies:       %d\n", (int)(b->cowcopies - a->cowcopies));
+  printf("cow reuses:       %d\n", (int)(b->cowreuses - a->cowreuses));
+  printf("zero page maps:   %d\n", (int)(b->zeromaps - a->zeromaps));
+  printf("zero page fills:  %d\n", (int)(b->zerofills - a->zerofills));
+  printf("lazy heap fills:  %d\n", (int)(b->lazyfills - a->lazyfills));
+  printf("page cache hits:  %d\n", (int)(b->pcachehits - a->pcachehits));
+  printf("page cache reads: %d\n", (int)(b->pcachemisses - a->pcachemisses));
+  printf("megapage merges:  %d\n", (int)(b->megapromotes - a->megapromotes));
+  printf("megapage splits:  %d\n", (int)(b->megademotes - a->megademotes));
+  printf("tlb flushes:      %d\n", (int)(b->tlbflushes - a->tlbflushes));
+  printf("asid flushes:     %d\n", (int)(b->asidflushes - a->asidflushes));
+  printf("asid rollovers:   %d\n", (int)(b->asidrollovers - a->asidrollovers));
+  printf("mmap fills:       %d\n", (int)(b->mmapfills - a->mmapfills));
+  printf("mmap writebacks:  %d\n", (int)(b->mmapwrites - a->mmapwrites));
+  printf("swap outs:        %d\n", (int)(b->swapouts - a->swapouts));
+  printf("swap ins:         %d\n", (int)(b->swapins - a->swapins));
+  printf("reclaim scans:    %d\n", (int)(b->swapscans - a->swapscans));
+  printf("reclaim failures: %d\n", (int)(b->swapfails - a->swapfails));
+  printf("bcache hits:      %d\n", (int)(b->bcachehits - a->bcachehits));
+  printf("bcache misses:    %d\n", (int)(b->bcachemisses - a->bcachemisses));
+  printf("bcache spins:     %d\n", (int)(b->bcachespins - a->bcachespins));
+  printf("bcache evictions: %d\n", (int)(b->bcacheevicts - a->bcacheevicts));
+  printf("bcache shrinks:   %d\n", (int)(b->bcacheshrinks - a->bcacheshrinks));
+  printf("readahead blocks: %d\n", (int)(b->readaheads - a->readaheads));
+  printf("readahead hits:   %d\n", (int)(b->rahits - a->rahits));
+  printf("disk requests:    %d\n", (int)(b->diskreqs - a->diskreqs));
+  printf("disk merges:      %d\n", (int)(b->diskmerges - a->diskmerges));
+  printf("disk queue depth: %d\n", b->diskreqs == a->diskreqs ? 0 :
+         (int)((b->diskqdepth - a->diskqdepth) / (b->diskreqs - a->diskreqs)));
+  printf("free pages:       %d\n", (int)b->freepages);
+  printf("free swap pages:  %d\n", (int)b->swapfree);
+  printf("swap pages:       %d\n", (int)b->swappages);
+  printf("bcache pages:     %d\n", (int)b->bcachepages);
+  printf("asids:            %d\n", (int)b->asids);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct kstats before, after;
+
+  memset(&before, 0, sizeof(before));
+  if(argc < 2){
+    if(kstats(&after) < 0){
+      fprintf(2, "memstat: kstats failed\n");
+      exit(1);
+    }
+    print(&before, &after);
+    exit(0);
+  }
+
+  kstats(&before);
+  int pid = fork();
+  if(pid < 0){
+    fprintf(2, "memstat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "memstat: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  kstats(&after);
+  print(&before, &after);
+  exit(0);
+}
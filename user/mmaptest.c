@@ -0,0 +1,265 @@
+//
+// tests for mmap() and munmap(), and a comparison of
+// scanning a file with read() and through a mapping.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define FILEPAGES 64      // 256 KB; the file system is small
+#define ROUNDS 20
+
+char *fname = "mmaptest.tmp";
+char buf[PGSIZE];
+
+void
+fail(char *what)
+{
+  printf("%s failed\n", what);
+  unlink(fname);
+  exit(-1);
+}
+
+// the byte at offset i of the test file.
+char
+fbyte(int i)
+{
+  return 'a' + (i / PGSIZE + i) % 26;
+}
+
+// Write a test file of n bytes.
+void
+makefile(int n)
+{
+  int fd, m;
+
+  unlink(fname);
+  if((fd = open(fname, O_CREATE | O_RDWR)) < 0)
+    fail("create");
+  for(int off = 0; off < n; off += m){
+    m = n - off < PGSIZE ? n - off : PGSIZE;
+    for(int i = 0; i < m; i++)
+      buf[i] = fbyte(off + i);
+    if(write(fd, buf, m) != m)
+      fail("write");
+  }
+  close(fd);
+}
+
+// A private mapping reads the file, including the partial last
+// page, and writes to it stay in this process.
+void
+privatetest()
+{
+  int n = 2 * PGSIZE + 100, fd;
+  char *p;
+
+  printf("private: ");
+  makefile(n);
+  if((fd = open(fname, O_RDONLY)) < 0)
+    fail("open");
+  p = mmap(0, n, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    fail("mmap");
+  close(fd);
+  for(int i = 0; i < n; i++)
+    if(p[i] != fbyte(i))
+      fail("read through mapping");
+  for(int i = n; i < 3 * PGSIZE; i++)
+    if(p[i] != 0)
+      fail("zero past end of file");
+  p[0] = 'Z';
+  if(munmap(p, n) < 0)
+    fail("munmap");
+
+  if((fd = open(fname, O_RDONLY)) < 0 || read(fd, buf, 1) != 1)
+    fail("reread");
+  close(fd);
+  if(buf[0] != fbyte(0))
+    fail("private write stayed private");
+  printf("ok\n");
+}
+
+// Writes to a shared mapping reach the file, but don't grow it,
+// and unmapping part of a mapping leaves the rest mapped.
+void
+sharedtest()
+{
+  int n = 3 * PGSIZE, fd;
+  char *p;
+
+  printf("shared: ");
+  makefile(n);
+  if((fd = open(fname, O_RDWR)) < 0)
+    fail("open");
+  p = mmap(0, n + 10, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    fail("mmap");
+  close(fd);
+  for(int i = 0; i < n + 10; i++)
+    p[i] = 'A' + i % 7;
+  if(munmap(p + PGSIZE, PGSIZE) < 0)
+    fail("munmap middle");
+  if(p[0] != 'A' || p[2 * PGSIZE] != 'A' + (2 * PGSIZE) % 7)
+    fail("rest of mapping");
+  if(munmap(p, PGSIZE) < 0 || munmap(p + 2 * PGSIZE, PGSIZE + 10) < 0)
+    fail("munmap ends");
+
+  if((fd = open(fname, O_RDONLY)) < 0)
+    fail("reopen");
+  for(int off = 0; off < n + PGSIZE; off += PGSIZE){
+    int m = read(fd, buf, PGSIZE);
+    if(off == n){
+      if(m != 0)
+        fail("file grew");
+      break;
+    }
+    if(m != PGSIZE)
+      fail("reread");
+    for(int i = 0; i < PGSIZE; i++)
+      if(buf[i] != 'A' + (off + i) % 7)
+        fail("write back");
+  }
+  close(fd);
+  printf("ok\n");
+}
+
+// After fork() a MAP_SHARED anonymous mapping is shared, even
+// pages nobody had touched, and a MAP_PRIVATE one is copied.
+void
+forktest()
+{
+  char *s, *q;
+  int pid, xstatus;
+
+  printf("fork: ");
+  s = mmap(0, 4 * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  q = mmap(0, 4 * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(s == MAP_FAILED || q == MAP_FAILED)
+    fail("mmap");
+  s[0] = 1;
+  q[0] = 1;
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    if(s[0] != 1 || q[0] != 1)
+      exit(1);
+    s[0] = 2;
+    s[3 * PGSIZE] = 3;
+    q[0] = 2;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    fail("child");
+  if(s[0] != 2 || s[3 * PGSIZE] != 3)
+    fail("shared write");
+  if(q[0] != 1)
+    fail("private write");
+  if(munmap(s, 4 * PGSIZE) < 0 || munmap(q, 4 * PGSIZE) < 0)
+    fail("munmap");
+  printf("ok\n");
+}
+
+// Bad arguments, touching unmapped memory, and mmap() in a
+// vfork() child.
+void
+errortest()
+{
+  int fd, pid, xstatus;
+  char *p;
+
+  printf("errors: ");
+  makefile(PGSIZE);
+  if((fd = open(fname, O_RDONLY)) < 0)
+    fail("open");
+  if(mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED)
+    fail("shared writable mapping of read-only file");
+  if(mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 100) != MAP_FAILED)
+    fail("unaligned offset");
+  if(mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE | MAP_SHARED, fd, 0) != MAP_FAILED)
+    fail("private and shared");
+  if((p = mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    fail("mmap");
+  close(fd);
+  if(munmap(p + 1, PGSIZE) == 0)
+    fail("unaligned munmap");
+  if(munmap(p, PGSIZE) < 0)
+    fail("munmap");
+
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    *(volatile char*)p;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1)
+    fail("unmapped memory was readable");
+
+  // a vfork() child must not map over its parent's mappings.
+  if((pid = vfork()) < 0)
+    fail("vfork");
+  if(pid == 0)
+    exit(mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0)
+    fail("mmap in vfork child");
+  printf("ok\n");
+}
+
+// Scan a file with read() and through a mapping.
+void
+scanbench()
+{
+  int n = FILEPAGES * PGSIZE, fd, start, tread, tmap, m;
+  uint sum1 = 0, sum2 = 0;
+  char *p;
+
+  printf("scan %d KB x %d: ", n / 1024, ROUNDS);
+  makefile(n);
+
+  start = uptime();
+  for(int r = 0; r < ROUNDS; r++){
+    if((fd = open(fname, O_RDONLY)) < 0)
+      fail("open");
+    while((m = read(fd, buf, PGSIZE)) > 0)
+      for(int i = 0; i < m; i++)
+        sum1 += buf[i];
+    close(fd);
+  }
+  tread = uptime() - start;
+
+  start = uptime();
+  for(int r = 0; r < ROUNDS; r++){
+    if((fd = open(fname, O_RDONLY)) < 0)
+      fail("open");
+    if((p = mmap(0, n, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+      fail("mmap");
+    close(fd);
+    for(int i = 0; i < n; i++)
+      sum2 += p[i];
+    munmap(p, n);
+  }
+  tmap = uptime() - start;
+
+  if(sum1 != sum2)
+    fail("scan");
+  printf("read() %d ticks, mmap() %d ticks\n", tread, tmap);
+}
+
+int
+main(int argc, char *argv[])
+{
+  privatetest();
+  sharedtest();
+  forktest();
+  errortest();
+  scanbench();
+  unlink(fname);
+  printf("ALL TESTS PASSED\n");
+  exit(0);
+}
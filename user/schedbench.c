@@ -0,0 +1,95 @@
+// Context-switch latency benchmark.
+//
+// Runs 1, 4 and 8 pairs of processes that bounce a byte back and
+// forth over a pair of pipes, so each round trip costs two context
+// switches, and reports the average time per switch.
+// Boot with make qemu CPUS=1 (and again with CPUS=4, CPUS=8)
+// to compare the per-CPU run queues at different core counts.
+//
+// usage: schedbench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define ROUNDS 5000
+#define USPERTICK 100000 // timerinit() interrupts about every 1/10th second
+
+void
+pingpong(int rounds)
+{
+  int ping[2], pong[2];
+  char c = 0;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+
+  int pid = fork();
+  if(pid < 0){
+    printf("schedbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < rounds; i++){
+      if(read(ping[0], &c, 1) != 1)
+        exit(1);
+      write(pong[1], &c, 1);
+    }
+    exit(0);
+  }
+
+  for(int i = 0; i < rounds; i++){
+    write(ping[1], &c, 1);
+    if(read(pong[0], &c, 1) != 1)
+      break;
+  }
+  wait(0);
+}
+
+void
+run(int npairs, int rounds)
+{
+  int start, elapsed, switches;
+
+  start = uptime();
+  for(int i = 0; i < npairs; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("schedbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      pingpong(rounds);
+      exit(0);
+    }
+  }
+  for(int i = 0; i < npairs; i++)
+    wait(0);
+  elapsed = uptime() - start;
+
+  switches = npairs * rounds * 2;
+  printf("%d pair(s): %d switches in %d ticks", npairs, switches, elapsed);
+  if(elapsed > 0)
+    printf(", %d us/switch", (elapsed * USPERTICK) / switches);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = ROUNDS;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds <= 0){
+    fprintf(2, "usage: schedbench [rounds]\n");
+    exit(1);
+  }
+
+  run(1, rounds);
+  run(4, rounds);
+  run(8, rounds);
+  exit(0);
+}
@@ -0,0 +1,29 @@
+// Print the kernel's slab caches: object size, pages and
+// objects in use, and how often the per-CPU magazines had to
+// go to the slabs.
+//
+// usage: slabinfo
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct slabinfo si[NSLAB];
+  int n;
+
+  if((n = slabinfo(si, NSLAB)) < 0){
+    fprintf(2, "slabinfo: slabinfo failed\n");
+    exit(1);
+  }
+  printf("cache     size  per page  pages  in use  cached  allocs  frees  misses\n");
+  for(int i = 0; i < n; i++)
+    printf("%s\t  %d\t%d\t  %d\t %d\t %d\t %d\t %d\t%d\n",
+           si[i].name, si[i].size, si[i].perslab, si[i].slabs,
+           si[i].inuse, si[i].cached, (int)si[i].allocs,
+           (int)si[i].frees, (int)si[i].misses);
+  exit(0);
+}
@@ -0,0 +1,113 @@
+//
+// tests for the slab allocator: open more files and pipes at
+// once than the old fixed tables held, check that the caches
+// grow and shrink back, and time pipe() and close().
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+#define NCHILD 20
+#define NPIPE  6          // pipes per child, within NOFILE
+#define ROUNDS 2000
+
+void
+fail(char *what)
+{
+  printf("%s failed\n", what);
+  exit(-1);
+}
+
+// The objects of cache name in use, or -1.
+int
+inuse(char *name)
+{
+  struct slabinfo si[NSLAB];
+  int n;
+
+  if((n = slabinfo(si, NSLAB)) < 0)
+    fail("slabinfo");
+  for(int i = 0; i < n; i++)
+    if(strcmp(si[i].name, name) == 0)
+      return si[i].inuse;
+  return -1;
+}
+
+// NCHILD children each hold NPIPE pipes open until the
+// parent, having counted them, closes the pipe they wait on.
+void
+growtest()
+{
+  int files, pipes, go[2], ready[2], fds[2];
+  char c;
+
+  printf("grow: ");
+  files = inuse("file");
+  pipes = inuse("pipe");
+  if(files < 0 || pipes < 0)
+    fail("find caches");
+  if(pipe(go) < 0 || pipe(ready) < 0)
+    fail("pipe");
+  for(int i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0)
+      fail("fork");
+    if(pid == 0){
+      close(go[1]);
+      close(ready[0]);
+      for(int j = 0; j < NPIPE; j++)
+        if(pipe(fds) < 0)
+          exit(1);
+      write(ready[1], "x", 1);
+      read(go[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(go[0]);
+  close(ready[1]);
+  for(int i = 0; i < NCHILD; i++)
+    if(read(ready[0], &c, 1) != 1)
+      fail("child pipes");
+  if(inuse("pipe") < pipes + NCHILD * NPIPE)
+    fail("pipe count");
+  if(inuse("file") < files + NCHILD * NPIPE * 2)
+    fail("file count");
+  close(go[1]);
+  for(int i = 0; i < NCHILD; i++){
+    int xstatus;
+    wait(&xstatus);
+    if(xstatus != 0)
+      fail("child");
+  }
+  close(ready[0]);
+  if(inuse("pipe") != pipes || inuse("file") != files)
+    fail("shrink");
+  printf("ok, %d files open at once\n", NCHILD * NPIPE * 2 + files);
+}
+
+void
+pipebench()
+{
+  int fds[2], start;
+
+  printf("pipe/close x %d: ", ROUNDS);
+  start = uptime();
+  for(int i = 0; i < ROUNDS; i++){
+    if(pipe(fds) < 0)
+      fail("pipe");
+    close(fds[0]);
+    close(fds[1]);
+  }
+  printf("%d ticks\n", uptime() - start);
+}
+
+int
+main(int argc, char *argv[])
+{
+  growtest();
+  pipebench();
+  printf("ALL TESTS PASSED\n");
+  exit(0);
+}
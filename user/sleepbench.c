@@ -0,0 +1,78 @@
+// Clock tick overhead benchmark.
+//
+// Measures how many uptime() calls a process gets through per
+// clock tick on its own, and again with 60 other processes
+// asleep in sleep(). If ticks wake only the sleepers that are
+// due, the two rates should be about the same.
+// Boot with make qemu CPUS=1 so that the sleepers and the
+// measuring process share a cpu.
+//
+// usage: sleepbench [ticks]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NSLEEPER 60
+#define TICKS 50
+
+int pids[NSLEEPER];
+
+// Return the number of uptime() calls made in n ticks.
+int
+spin(int n)
+{
+  int start, count = 0;
+
+  // start on a tick boundary.
+  start = uptime();
+  while(uptime() == start)
+    ;
+  start++;
+  while(uptime() - start < n)
+    count++;
+  return count;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = TICKS;
+  int idle, loaded;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    fprintf(2, "usage: sleepbench [ticks]\n");
+    exit(1);
+  }
+
+  idle = spin(n);
+
+  for(int i = 0; i < NSLEEPER; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf("sleepbench: fork failed\n");
+      exit(1);
+    }
+    if(pids[i] == 0){
+      sleep(1000000);
+      exit(0);
+    }
+  }
+  // let the sleepers get to sleep.
+  sleep(2);
+
+  loaded = spin(n);
+
+  for(int i = 0; i < NSLEEPER; i++)
+    kill(pids[i]);
+  for(int i = 0; i < NSLEEPER; i++)
+    wait(0);
+
+  printf("0 sleepers: %d calls/tick\n", idle / n);
+  printf("%d sleepers: %d calls/tick\n", NSLEEPER, loaded / n);
+  if(idle > 0)
+    printf("per-tick overhead: %d%%\n", ((idle - loaded) * 100) / idle);
+  exit(0);
+}
@@ -0,0 +1,96 @@
+//
+// tests for swapping: use more memory than the machine has,
+// and check that every page comes back from swap intact,
+// in a process and in a child that shares its swapped pages.
+//
+
+#include "kernel/types.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+
+void
+fail(char *what)
+{
+  printf("%s failed\n", what);
+  exit(-1);
+}
+
+// the word at the start of page i, after generation gen of writes.
+uint
+pword(int i, int gen)
+{
+  return i * 2654435761U + gen;
+}
+
+// Check every step'th page of the npages at p.
+void
+verify(char *p, int npages, int step, int gen, char *what)
+{
+  for(int i = 0; i < npages; i += step)
+    if(*(uint*)(p + (uint64)i * PGSIZE) != pword(i, gen))
+      fail(what);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct kstats before, after;
+  int npages, pid, xstatus, start;
+  char *p;
+
+  if(kstats(&before) < 0)
+    fail("kstats");
+  if(before.swapfree == 0){
+    printf("swaptest: no swap\n");
+    exit(0);
+  }
+  // more than fits in memory, with room to spare in swap.
+  npages = before.freepages + before.swapfree / 4;
+  printf("swaptest: %d pages, %d free, %d in swap\n",
+         npages, (int)before.freepages, (int)before.swapfree);
+
+  start = uptime();
+  if((p = sbrk((uint64)npages * PGSIZE)) == (char*)-1)
+    fail("sbrk");
+  printf("write: ");
+  for(int i = 0; i < npages; i++)
+    *(uint*)(p + (uint64)i * PGSIZE) = pword(i, 0);
+  printf("ok\n");
+
+  printf("read back: ");
+  verify(p, npages, 1, 0, "read back");
+  printf("ok\n");
+
+  // the child reads the pages it shares with its parent from
+  // swap, and changes some, which the parent must not see.
+  printf("fork: ");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    verify(p, npages, 1, 0, "child read");
+    for(int i = 0; i < npages; i += 8)
+      *(uint*)(p + (uint64)i * PGSIZE) = pword(i, 1);
+    verify(p, npages, 8, 1, "child write");
+    exit(0);
+  }
+  verify(p, npages, 1, 0, "parent read");
+  wait(&xstatus);
+  if(xstatus != 0)
+    fail("child");
+  verify(p, npages, 1, 0, "parent after child");
+  printf("ok\n");
+
+  kstats(&after);
+  printf("%d ticks, %d swap outs, %d swap ins, %d scans, %d failures\n",
+         uptime() - start,
+         (int)(after.swapouts - before.swapouts),
+         (int)(after.swapins - before.swapins),
+         (int)(after.swapscans - before.swapscans),
+         (int)(after.swapfails - before.swapfails));
+  if(after.swapouts == before.swapouts)
+    fail("nothing was swapped out");
+  printf("ALL TESTS PASSED\n");
+  exit(0);
+}
@@ -0,0 +1,91 @@
+// TLB benchmark for heap megapages.
+//
+// Touches one word in every page of a 2MB-aligned 32 MB heap
+// region, in a scattered order, for a number of rounds. The
+// parent's region becomes megapages as each 2MB of it is filled
+// in; a forked child then writes to each 2MB of it, which splits
+// them into 4 KB pages, and runs the same loop, so the two times
+// compare the same work with 16 TLB entries' worth of mappings
+// and with 8192.
+//
+// usage: tlbbench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+#define PGSIZE   4096
+#define MEGASIZE (2*1024*1024)
+#define NPAGES   8192   // 32 MB
+#define STRIDE   613    // pages between accesses; prime, so all get visited
+#define ROUNDS   200
+
+int
+sweep(char *region, int rounds)
+{
+  volatile int sum = 0;
+  int start, pg;
+
+  start = uptime();
+  for(int r = 0; r < rounds; r++){
+    pg = 0;
+    for(int i = 0; i < NPAGES; i++){
+      sum += region[(uint64)pg * PGSIZE];
+      pg = (pg + STRIDE) % NPAGES;
+    }
+  }
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = ROUNDS;
+  struct kstats before, after;
+  uint64 cur;
+  char *region;
+  int pid;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds <= 0){
+    fprintf(2, "usage: tlbbench [rounds]\n");
+    exit(1);
+  }
+
+  // start the region on a 2MB boundary.
+  cur = (uint64)sbrk(0);
+  if(sbrk((MEGASIZE - cur % MEGASIZE) % MEGASIZE) == (char*)-1 ||
+     (region = sbrk(NPAGES * PGSIZE)) == (char*)-1){
+    fprintf(2, "tlbbench: sbrk failed\n");
+    exit(1);
+  }
+
+  kstats(&before);
+  for(int i = 0; i < NPAGES; i++)
+    region[(uint64)i * PGSIZE] = 1;
+  kstats(&after);
+  printf("touched %d pages: %d faults, %d megapages\n", NPAGES,
+         (int)(after.faults - before.faults),
+         (int)(after.megapromotes - before.megapromotes));
+
+  printf("megapages: %d ticks for %d rounds\n", sweep(region, rounds), rounds);
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "tlbbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    kstats(&before);
+    for(int i = 0; i < NPAGES * PGSIZE; i += MEGASIZE)
+      region[i] = 2;
+    kstats(&after);
+    printf("child split %d megapages\n",
+           (int)(after.megademotes - before.megademotes));
+    printf("4KB pages: %d ticks for %d rounds\n", sweep(region, rounds), rounds);
+    exit(0);
+  }
+  wait(0);
+  exit(0);
+}
@@ -1,4 +1,6 @@
 struct stat;
+struct kstats;
+struct slabinfo;
 
 // system calls
 int fork(void);
@@ -29,6 +31,11 @@ int sigreturn(void);
 int setpriority(int newpriority, int pid);
 int settickets(int numbertickets);
 int waitx(int*, int* /*wtime*/, int* /*rtime*/);
+int kstats(struct kstats*);
+int vfork(void);  // the child may only exec() or exit()
+void* mmap(void*, uint64, int, int, int, int);
+int munmap(void*, uint64);
+int slabinfo(struct slabinfo*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
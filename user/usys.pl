@@ -42,4 +42,9 @@ entry("sigreturn");
 entry("sigalarm");
 entry("setpriority");
 entry("settickets");
-entry("waitx");
\ No newline at end of file
+entry("waitx");
+entry("kstats");
+entry("vfork");
+entry("mmap");
+entry("munmap");
+entry("slabinfo");
\ No newline at end of file